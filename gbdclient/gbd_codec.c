@@ -0,0 +1,186 @@
+/*
+ * file : gbd_codec.c
+ * desc : compact PCM wire encodings for the gbd (Generic Beat Detector)
+ *        framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#include "gbd_codec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GBD_NEON 1
+#endif
+
+#define GBD_S16_SCALE 32767.0f
+
+static inline int16_t f32_to_s16(float x)
+{
+	x *= GBD_S16_SCALE;
+	if (x >= GBD_S16_SCALE)
+		return 32767;
+	if (x <= -32768.0f)
+		return -32768;
+	return (int16_t)(x >= 0.0f ? x + 0.5f : x - 0.5f);
+}
+
+void gbd_f32_to_s16(int16_t *dst, const float *src, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(GBD_S16_SCALE);
+	const __m128 hi = _mm_set1_ps(32767.0f);
+	const __m128 lo = _mm_set1_ps(-32768.0f);
+	const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	const __m128 half = _mm_set1_ps(0.5f);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+		__m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+		a = _mm_max_ps(_mm_min_ps(a, hi), lo);
+		b = _mm_max_ps(_mm_min_ps(b, hi), lo);
+		/* round half away from zero, as f32_to_s16(): add the
+		 * signed half, then truncate */
+		a = _mm_add_ps(a, _mm_or_ps(_mm_and_ps(a, sign), half));
+		b = _mm_add_ps(b, _mm_or_ps(_mm_and_ps(b, sign), half));
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_packs_epi32(_mm_cvttps_epi32(a),
+						 _mm_cvttps_epi32(b)));
+	}
+#elif defined(GBD_NEON)
+	const uint32x4_t sign = vdupq_n_u32(0x80000000u);
+	const uint32x4_t half = vreinterpretq_u32_f32(vdupq_n_f32(0.5f));
+
+	for (; i + 8 <= n; i += 8) {
+		float32x4_t a = vmulq_n_f32(vld1q_f32(src + i), GBD_S16_SCALE);
+		float32x4_t b = vmulq_n_f32(vld1q_f32(src + i + 4), GBD_S16_SCALE);
+		/* round half away from zero, vcvt truncates and saturates */
+		a = vaddq_f32(a, vreinterpretq_f32_u32(
+			vorrq_u32(vandq_u32(vreinterpretq_u32_f32(a), sign), half)));
+		b = vaddq_f32(b, vreinterpretq_f32_u32(
+			vorrq_u32(vandq_u32(vreinterpretq_u32_f32(b), sign), half)));
+		vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)),
+						vqmovn_s32(vcvtq_s32_f32(b))));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = f32_to_s16(src[i]);
+}
+
+void gbd_s16_to_f32(float *dst, const int16_t *src, size_t n)
+{
+	const float scale = 1.0f / GBD_S16_SCALE;
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128 vscale = _mm_set1_ps(scale);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), vscale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), vscale));
+	}
+#elif defined(GBD_NEON)
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t v = vld1q_s16(src + i);
+		vst1q_f32(dst + i, vmulq_n_f32(
+			vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(
+			vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = src[i] * scale;
+}
+
+/* plain loop, left to the auto-vectorizer */
+void gbd_s32_to_f32(float *dst, const int32_t *src, size_t n)
+{
+	const float scale = 1.0f / 2147483648.0f;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = src[i] * scale;
+}
+
+/* MSB first bit writer */
+struct bitio {
+	uint8_t *p;
+	uint64_t acc;
+	int bits;
+};
+
+static inline void put_bits(struct bitio *b, uint32_t v, int n)
+{
+	b->acc = (b->acc << n) | (v & ((1u << n) - 1));
+	b->bits += n;
+	while (b->bits >= 8) {
+		b->bits -= 8;
+		*b->p++ = (uint8_t)(b->acc >> b->bits);
+	}
+}
+
+static inline void put_ones(struct bitio *b, int n)
+{
+	for (; n > 16; n -= 16)
+		put_bits(b, 0xffff, 16);
+	put_bits(b, 0xffff, n);
+}
+
+static inline uint32_t zigzag(int32_t d)
+{
+	return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+size_t gbd_rice_encode(uint8_t *dst, const int16_t *src,
+		       size_t frames, unsigned int channels)
+{
+	struct bitio b = { dst, 0, 0 };
+	unsigned int c;
+	uint64_t sum;
+	uint32_t u, q;
+	size_t i;
+	int k;
+
+	for (c = 0; c < channels; c++) {
+		const int16_t *x = src + c;
+
+		/* k ~ log2(mean |delta|) */
+		sum = 0;
+		for (i = 1; i < frames; i++)
+			sum += zigzag(x[i * channels] - x[(i - 1) * channels]);
+		for (k = 0; k < 15 && ((uint64_t)frames << (k + 1)) < sum; k++)
+			;
+
+		put_bits(&b, k, 4);
+		put_bits(&b, (uint16_t)x[0], 16);
+		for (i = 1; i < frames; i++) {
+			u = zigzag(x[i * channels] - x[(i - 1) * channels]);
+			q = u >> k;
+			if (q < GBD_RICE_ESC) {
+				put_ones(&b, q);
+				put_bits(&b, 0, 1);
+				if (k)
+					put_bits(&b, u, k);
+			} else {
+				put_ones(&b, GBD_RICE_ESC);
+				put_bits(&b, u, 17);
+			}
+		}
+	}
+	if (b.bits)
+		put_bits(&b, 0, 8 - b.bits);
+	return b.p - dst;
+}
@@ -0,0 +1,53 @@
+/*
+ * file : gbd_codec.h
+ * desc : compact PCM wire encodings for the gbd (Generic Beat Detector)
+ *        framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_CODEC_H__
+#define __GBD_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Wire encodings (negotiated with GBD_PCM_ENCODING):
+ *
+ * GBD_ENCODING_FLOAT  interleaved 32-bit float, i.e. the v1 stream
+ * GBD_ENCODING_S16    interleaved 16-bit signed, half the bandwidth
+ * GBD_ENCODING_RICE   16-bit samples, per-channel delta + Rice coded;
+ *                     lossless w.r.t. S16, typically 25-40% of FLOAT
+ *
+ * Rice bitstream (MSB first), one block per channel and period:
+ *   4 bits k, 16 bits first sample, then for every following sample
+ *   the zigzag mapped delta u: q = u >> k ones, a zero and the k low
+ *   bits of u; quotients >= GBD_RICE_ESC are sent as GBD_RICE_ESC ones
+ *   followed by u in 17 raw bits. The stream is zero padded to a byte. */
+#define GBD_ENCODING_FLOAT 0
+#define GBD_ENCODING_S16 1
+#define GBD_ENCODING_RICE 2
+
+#define GBD_RICE_ESC 8
+
+/* float <-> s16 conversion (SSE2/NEON when available) */
+void gbd_f32_to_s16(int16_t *dst, const float *src, size_t n);
+void gbd_s16_to_f32(float *dst, const int16_t *src, size_t n);
+void gbd_s32_to_f32(float *dst, const int32_t *src, size_t n);
+
+/* worst case size of a Rice coded period */
+static inline size_t gbd_rice_bound(size_t frames, unsigned int channels)
+{
+	return (channels * (20 + 25 * frames) + 7) / 8;
+}
+
+size_t gbd_rice_encode(uint8_t *dst, const int16_t *src,
+		       size_t frames, unsigned int channels);
+
+#endif /* __GBD_CODEC_H__ */
@@ -0,0 +1,275 @@
+/*
+ * file : gbd_features.c
+ * desc : client side band energy extraction for the gbd (Generic Beat
+ *        Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "gbd_features.h"
+
+#ifdef GBD_FIXED
+/* Q30 power to that of -1.0..1.0 samples */
+#define GBD_FEATURE_POW_SCALE (1.0f / (1u << 30))
+
+static inline gbd_fft_q_t gbd_features_win(gbd_fft_q_t x, gbd_fft_q_t w)
+{
+	return (gbd_fft_q_t)(((int32_t)x * w + (1 << 14)) >> 15);
+}
+#else
+#define GBD_FEATURE_POW_SCALE 1.0f
+
+static inline float gbd_features_win(float x, float w)
+{
+	return x * w;
+}
+#endif
+
+/* the filterbank: bands log spaced up to 0.45 rate at most, where
+ * the band-pass design still holds */
+static int gbd_features_init_iir(gbd_features_t *f)
+{
+	float lo[GBD_FEATURE_BANDS_MAX], hi[GBD_FEATURE_BANDS_MAX];
+	float fmax = f->rate * 0.45f;
+	unsigned int k;
+	int err;
+
+	if (fmax > GBD_FEATURE_FMAX)
+		fmax = GBD_FEATURE_FMAX;
+	f->fmax = fmax;
+	for (k = 0; k < f->bands; k++) {
+		lo[k] = GBD_FEATURE_FMIN * powf(fmax / GBD_FEATURE_FMIN,
+						(float)k / f->bands);
+		hi[k] = GBD_FEATURE_FMIN * powf(fmax / GBD_FEATURE_FMIN,
+						(float)(k + 1) / f->bands);
+	}
+	f->mono = malloc(GBD_FEATURE_BLOCK * sizeof(float));
+	if (!f->mono) {
+		gbd_features_free(f);
+		return -ENOMEM;
+	}
+	err = gbd_iir_init(&f->iir, f->rate, f->bands, lo, hi);
+	if (err < 0) {
+		gbd_features_free(f);
+		return err;
+	}
+	return 0;
+}
+
+int gbd_features_init(gbd_features_t *f, unsigned int rate,
+		      unsigned int channels, unsigned int mix,
+		      unsigned int bands, unsigned int hop,
+		      unsigned int size, int engine)
+{
+	unsigned int n, k, i, nbins;
+	uint32_t edge;
+	float fmax, hz;
+	int err;
+
+	memset(f, 0, sizeof(*f));
+	if (!hop || !mix || mix > channels || !bands ||
+	    bands > GBD_FEATURE_BANDS_MAX)
+		return -EINVAL;
+
+	if (engine == GBD_FEATURE_IIR) {
+		if (size)
+			return -EINVAL;
+		f->engine = engine;
+		f->rate = rate;
+		f->bands = bands;
+		f->hop = hop;
+		f->channels = channels;
+		f->mix = mix;
+		return gbd_features_init_iir(f);
+	}
+
+	if (size) {
+		if (size < 16 || size > GBD_FEATURE_WINDOW_MAX || size < hop ||
+		    (size & (size - 1)))
+			return -EINVAL;
+		n = size;
+	} else
+		for (n = 16; n < 2 * hop; n <<= 1)
+			;
+	nbins = n / 2 + 1;
+	if (bands > nbins - 1)
+		return -EINVAL;
+
+	f->rate = rate;
+	f->bands = bands;
+	f->hop = hop;
+	f->size = n;
+	f->channels = channels;
+	f->mix = mix;
+	f->hist = calloc(n, sizeof(gbd_fft_q_t));
+	f->window = malloc(n * sizeof(gbd_fft_q_t));
+	f->frame = malloc(n * sizeof(gbd_fft_q_t));
+	f->power = malloc(nbins * sizeof(gbd_fft_pow_t));
+	f->lo = malloc(bands * sizeof(uint32_t));
+	f->hi = malloc(bands * sizeof(uint32_t));
+	if (!f->hist || !f->window || !f->frame || !f->power || !f->lo ||
+	    !f->hi) {
+		gbd_features_free(f);
+		return -ENOMEM;
+	}
+	err = gbd_fft_init(&f->fft, n);
+	if (err < 0) {
+		gbd_features_free(f);
+		return err;
+	}
+
+	for (i = 0; i < n; i++)
+		f->window[i] = gbd_fft_q(0.5f - 0.5f *
+					 cosf(2.0f * (float)M_PI * i / n));
+
+	/* log spaced bands back to back, at least one bin wide */
+	fmax = rate / 2.0f < GBD_FEATURE_FMAX ? rate / 2.0f : GBD_FEATURE_FMAX;
+	f->fmax = fmax;
+	for (k = 0; k <= bands; k++) {
+		hz = GBD_FEATURE_FMIN * powf(fmax / GBD_FEATURE_FMIN,
+					     (float)k / bands);
+		edge = (uint32_t)(hz * n / rate + 0.5f);
+		if (k && edge <= f->lo[k - 1])
+			edge = f->lo[k - 1] + 1;
+		if (edge > nbins - (bands - k))
+			edge = nbins - (bands - k);
+		if (k)
+			f->hi[k - 1] = edge;
+		if (k < bands)
+			f->lo[k] = edge;
+	}
+	return 0;
+}
+
+int gbd_features_set_bands(gbd_features_t *f, const float *lo,
+			   const float *hi)
+{
+	unsigned int nbins = f->size / 2 + 1, b;
+	gbd_iir_t iir;
+	int err;
+
+	for (b = 0; b < f->bands; b++)
+		if (lo[b] <= 0.0f || hi[b] <= lo[b] || hi[b] >= f->rate / 2.0f)
+			return -EINVAL;
+
+	if (f->engine == GBD_FEATURE_IIR) {
+		err = gbd_iir_init(&iir, f->rate, f->bands, lo, hi);
+		if (err < 0)
+			return err;
+		gbd_iir_free(&f->iir);
+		f->iir = iir;
+		return 0;
+	}
+
+	/* bins whose centre is in the range, at least one */
+	for (b = 0; b < f->bands; b++) {
+		f->lo[b] = (uint32_t)(lo[b] * f->size / f->rate + 0.5f);
+		f->hi[b] = (uint32_t)(hi[b] * f->size / f->rate + 0.5f);
+		if (f->lo[b] > nbins - 1)
+			f->lo[b] = nbins - 1;
+		if (f->hi[b] <= f->lo[b])
+			f->hi[b] = f->lo[b] + 1;
+	}
+	return 0;
+}
+
+void gbd_features_free(gbd_features_t *f)
+{
+	free(f->hist);
+	free(f->window);
+	free(f->frame);
+	free(f->power);
+	gbd_fft_free(&f->fft);
+	free(f->lo);
+	free(f->hi);
+	gbd_iir_free(&f->iir);
+	free(f->mono);
+	memset(f, 0, sizeof(*f));
+}
+
+static void gbd_features_hop(gbd_features_t *f, float *out)
+{
+	unsigned int n = f->size, i, b, k;
+	const float scale = GBD_FEATURE_POW_SCALE / ((float)n * n);
+	gbd_fft_pow_t sum;
+
+	for (i = 0; i < n; i++)
+		f->frame[i] = gbd_features_win(f->hist[(f->pos + i) & (n - 1)],
+					       f->window[i]);
+	gbd_fft_power(&f->fft, f->frame, f->power);
+
+	for (b = 0; b < f->bands; b++) {
+		sum = 0;
+		for (k = f->lo[b]; k < f->hi[b]; k++)
+			sum += f->power[k];
+		out[b] = (float)sum * scale / (f->hi[b] - f->lo[b]);
+	}
+}
+
+/* mixes the frames down in blocks that end at the hops and runs each
+ * through the filterbank */
+static size_t gbd_features_process_iir(gbd_features_t *f, const float *src,
+				       size_t frames, float *out)
+{
+	const float gain = 1.0f / f->mix;
+	size_t i, n, nvec = 0;
+	unsigned int c;
+	float x;
+
+	for (; frames; frames -= n) {
+		n = f->hop - f->pending;
+		if (n > GBD_FEATURE_BLOCK)
+			n = GBD_FEATURE_BLOCK;
+		if (n > frames)
+			n = frames;
+		for (i = 0; i < n; i++, src += f->channels) {
+			for (x = 0.0f, c = 0; c < f->mix; c++)
+				x += src[c];
+			f->mono[i] = x * gain;
+		}
+		gbd_iir_run(&f->iir, f->mono, n);
+		f->pending += n;
+		if (f->pending == f->hop) {
+			f->pending = 0;
+			gbd_iir_take(&f->iir, out + nvec * f->bands, f->hop);
+			nvec++;
+		}
+	}
+	return nvec;
+}
+
+size_t gbd_features_process(gbd_features_t *f, const float *src,
+			    size_t frames, float *out)
+{
+	const float gain = 1.0f / f->mix;
+	size_t i, nvec = 0;
+	unsigned int c;
+	float x;
+
+	if (f->engine == GBD_FEATURE_IIR)
+		return gbd_features_process_iir(f, src, frames, out);
+
+	for (i = 0; i < frames; i++, src += f->channels) {
+		for (x = 0.0f, c = 0; c < f->mix; c++)
+			x += src[c];
+		f->hist[f->pos] = gbd_fft_q(x * gain);
+		f->pos = (f->pos + 1) & (f->size - 1);
+		if (++f->pending == f->hop) {
+			f->pending = 0;
+			gbd_features_hop(f, out + nvec * f->bands);
+			nvec++;
+		}
+	}
+	return nvec;
+}
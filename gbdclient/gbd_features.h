@@ -0,0 +1,102 @@
+/*
+ * file : gbd_features.h
+ * desc : client side band energy extraction for the gbd (Generic Beat
+ *        Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_FEATURES_H__
+#define __GBD_FEATURES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gbd_fft.h"
+#include "gbd_iir.h"
+
+#define GBD_FEATURE_BANDS_MIN 4
+#define GBD_FEATURE_BANDS_MAX 32
+#define GBD_FEATURE_FMIN 30.0f
+#define GBD_FEATURE_FMAX 16000.0f
+#define GBD_FEATURE_WINDOW_MAX 32768
+#define GBD_FEATURE_BLOCK 256	/* iir: frames mixed down at a time */
+
+/* engines */
+#define GBD_FEATURE_FFT 0
+#define GBD_FEATURE_IIR 1
+
+/*
+ * Every hop samples the (mono mixed) signal is Hann windowed over the
+ * last size samples (a power of two >= hop, by default the smallest
+ * one >= 2 * hop) and transformed, i.e. the analysis buffer is the
+ * plugin's own and the hop decides the time resolution whatever the
+ * alsa period; the power spectrum is summed into bands log spaced
+ * between GBD_FEATURE_FMIN and GBD_FEATURE_FMAX. One feature vector
+ * holds the mean bin power of each band. In GBD_FIXED builds the signal
+ * is kept, windowed and transformed in Q15 (see gbd_fft.h); only the
+ * band powers are converted to float, for the wire. A band then differs
+ * from the float build's by at most 5e-4 of the vector's total power
+ * plus 1e-9, the Q15 rounding of the signal (some 90 dB below a full
+ * scale sine).
+ *
+ * The GBD_FEATURE_IIR engine has no window (size is 0) and no latency
+ * past its filters' (see gbd_iir.h): each band is a band-pass filter
+ * between the same log spaced edges, up to 0.45 rate at most, and a
+ * feature vector holds the mean square of each filter's output over
+ * the hop. It runs in float, also in GBD_FIXED builds.
+ */
+typedef struct __gbd_features {
+	int engine;		/* GBD_FEATURE_* */
+	unsigned int rate;
+	unsigned int bands;
+	unsigned int hop;
+	unsigned int size;
+	unsigned int channels;	/* per frame */
+	unsigned int mix;	/* the first ones, mixed to mono */
+	unsigned int pos;	/* write position in hist */
+	unsigned int pending;	/* samples since the last hop */
+	float fmax;
+	gbd_fft_q_t *hist;	/* circular analysis buffer */
+	gbd_fft_q_t *window;
+	gbd_fft_q_t *frame;	/* windowed, size */
+	gbd_fft_pow_t *power;	/* spectrum, size / 2 + 1 */
+	gbd_fft_t fft;
+	uint32_t *lo, *hi;	/* bins of each band, [lo, hi) */
+	gbd_iir_t iir;
+	float *mono;		/* iir: mixed down block */
+} gbd_features_t;
+
+/* frames of channels samples, of which the first mix make up the
+ * signal (e.g. not a forwarded LFE); size 0 picks the default
+ * transform length, it must be 0 for the GBD_FEATURE_IIR engine. The
+ * bands come log spaced. */
+int gbd_features_init(gbd_features_t *f, unsigned int rate,
+		      unsigned int channels, unsigned int mix,
+		      unsigned int bands, unsigned int hop,
+		      unsigned int size, int engine);
+void gbd_features_free(gbd_features_t *f);
+
+/* replaces the log spaced bands by bands ranges lo[b]..hi[b] Hz,
+ * 0 < lo < hi < rate / 2, which may overlap or leave gaps */
+int gbd_features_set_bands(gbd_features_t *f, const float *lo,
+			   const float *hi);
+
+/* most vectors gbd_features_process() can return for frames */
+static inline size_t gbd_features_max(const gbd_features_t *f, size_t frames)
+{
+	return (f->pending + frames) / f->hop;
+}
+
+/* feeds interleaved frames, stores the completed feature vectors
+ * (bands floats each) at out and returns their number */
+size_t gbd_features_process(gbd_features_t *f, const float *src,
+			    size_t frames, float *out);
+
+#endif /* __GBD_FEATURES_H__ */
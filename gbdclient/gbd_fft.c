@@ -0,0 +1,377 @@
+/*
+ * file : gbd_fft.c
+ * desc : real input power spectrum transform for the gbd (Generic Beat
+ *        Detector) framework, with SIMD backends
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "gbd_fft.h"
+
+#if defined(GBD_FIXED)
+/* no SIMD backends */
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GBD_NEON 1
+#endif
+
+/* transforms timed by gbd_fft_init() */
+#define GBD_FFT_BENCH 32
+
+#ifdef GBD_FIXED
+/* a x + b y, x and y Q15 */
+static inline int32_t gbd_fft_mac(int32_t a, int16_t x, int32_t b, int16_t y)
+{
+	return (int32_t)(((int64_t)a * x + (int64_t)b * y + (1 << 14)) >> 15);
+}
+#else
+static inline float gbd_fft_mac(float a, float x, float b, float y)
+{
+	return a * x + b * y;
+}
+#endif
+
+/* stages 1 and 2 as one radix-4 pass; their twiddles are 1 and -i */
+static void gbd_fft_radix4(gbd_fft_acc_t *restrict re,
+			   gbd_fft_acc_t *restrict im, unsigned int m)
+{
+	gbd_fft_acc_t a0r, a0i, a1r, a1i, a2r, a2i, a3r, a3i;
+	unsigned int b;
+
+	for (b = 0; b < m; b += 4) {
+		a0r = re[b] + re[b + 1];
+		a0i = im[b] + im[b + 1];
+		a1r = re[b] - re[b + 1];
+		a1i = im[b] - im[b + 1];
+		a2r = re[b + 2] + re[b + 3];
+		a2i = im[b + 2] + im[b + 3];
+		a3r = re[b + 2] - re[b + 3];
+		a3i = im[b + 2] - im[b + 3];
+		re[b] = a0r + a2r;
+		im[b] = a0i + a2i;
+		re[b + 2] = a0r - a2r;
+		im[b + 2] = a0i - a2i;
+		/* a3 * -i */
+		re[b + 1] = a1r + a3i;
+		im[b + 1] = a1i - a3r;
+		re[b + 3] = a1r - a3i;
+		im[b + 3] = a1i + a3r;
+	}
+}
+
+/* one radix-2 stage combining h point transforms */
+static void gbd_fft_stage(gbd_fft_acc_t *restrict re,
+			  gbd_fft_acc_t *restrict im,
+			  const gbd_fft_q_t *restrict wr,
+			  const gbd_fft_q_t *restrict wi,
+			  unsigned int m, unsigned int h)
+{
+	unsigned int b, k;
+
+	for (b = 0; b < m; b += 2 * h) {
+		gbd_fft_acc_t *restrict ar = re + b, *restrict ai = im + b;
+		gbd_fft_acc_t *restrict br = re + b + h, *restrict bi = im + b + h;
+
+		for (k = 0; k < h; k++) {
+			gbd_fft_acc_t tr = gbd_fft_mac(br[k], wr[k], -bi[k], wi[k]);
+			gbd_fft_acc_t ti = gbd_fft_mac(br[k], wi[k], bi[k], wr[k]);
+			br[k] = ar[k] - tr;
+			bi[k] = ai[k] - ti;
+			ar[k] += tr;
+			ai[k] += ti;
+		}
+	}
+}
+
+static void gbd_fft_stages_scalar(const gbd_fft_t *t, gbd_fft_acc_t *re,
+				  gbd_fft_acc_t *im)
+{
+	unsigned int h;
+
+	for (h = 4; h < t->m; h <<= 1)
+		gbd_fft_stage(re, im, t->tw_re + h - 1, t->tw_im + h - 1,
+			      t->m, h);
+}
+
+#if defined(GBD_FIXED)
+/* scalar only */
+#elif defined(__SSE2__)
+static inline void gbd_fft_stage_sse2(float *re, float *im, const float *wr,
+				      const float *wi, unsigned int m,
+				      unsigned int h)
+{
+	unsigned int b, k;
+
+	for (b = 0; b < m; b += 2 * h)
+		for (k = 0; k < h; k += 4) {
+			float *ar = re + b + k, *ai = im + b + k;
+			float *br = ar + h, *bi = ai + h;
+			__m128 xr = _mm_loadu_ps(wr + k), xi = _mm_loadu_ps(wi + k);
+			__m128 vbr = _mm_loadu_ps(br), vbi = _mm_loadu_ps(bi);
+			__m128 var = _mm_loadu_ps(ar), vai = _mm_loadu_ps(ai);
+			__m128 tr = _mm_sub_ps(_mm_mul_ps(vbr, xr),
+					       _mm_mul_ps(vbi, xi));
+			__m128 ti = _mm_add_ps(_mm_mul_ps(vbr, xi),
+					       _mm_mul_ps(vbi, xr));
+
+			_mm_storeu_ps(br, _mm_sub_ps(var, tr));
+			_mm_storeu_ps(bi, _mm_sub_ps(vai, ti));
+			_mm_storeu_ps(ar, _mm_add_ps(var, tr));
+			_mm_storeu_ps(ai, _mm_add_ps(vai, ti));
+		}
+}
+
+static void gbd_fft_stages_sse2(const gbd_fft_t *t, float *re, float *im)
+{
+	unsigned int h;
+
+	for (h = 4; h < t->m; h <<= 1)
+		gbd_fft_stage_sse2(re, im, t->tw_re + h - 1, t->tw_im + h - 1,
+				   t->m, h);
+}
+
+__attribute__((target("avx")))
+static void gbd_fft_stages_avx(const gbd_fft_t *t, float *re, float *im)
+{
+	unsigned int h = 4, b, k;
+
+	/* four lanes for the first stage, eight after that */
+	if (h < t->m)
+		gbd_fft_stage_sse2(re, im, t->tw_re + h - 1, t->tw_im + h - 1,
+				   t->m, h);
+	for (h = 8; h < t->m; h <<= 1) {
+		const float *wr = t->tw_re + h - 1, *wi = t->tw_im + h - 1;
+
+		for (b = 0; b < t->m; b += 2 * h)
+			for (k = 0; k < h; k += 8) {
+				float *ar = re + b + k, *ai = im + b + k;
+				float *br = ar + h, *bi = ai + h;
+				__m256 xr = _mm256_loadu_ps(wr + k);
+				__m256 xi = _mm256_loadu_ps(wi + k);
+				__m256 vbr = _mm256_loadu_ps(br);
+				__m256 vbi = _mm256_loadu_ps(bi);
+				__m256 var = _mm256_loadu_ps(ar);
+				__m256 vai = _mm256_loadu_ps(ai);
+				__m256 tr = _mm256_sub_ps(_mm256_mul_ps(vbr, xr),
+							  _mm256_mul_ps(vbi, xi));
+				__m256 ti = _mm256_add_ps(_mm256_mul_ps(vbr, xi),
+							  _mm256_mul_ps(vbi, xr));
+
+				_mm256_storeu_ps(br, _mm256_sub_ps(var, tr));
+				_mm256_storeu_ps(bi, _mm256_sub_ps(vai, ti));
+				_mm256_storeu_ps(ar, _mm256_add_ps(var, tr));
+				_mm256_storeu_ps(ai, _mm256_add_ps(vai, ti));
+			}
+	}
+	_mm256_zeroupper();
+}
+#elif defined(GBD_NEON)
+static void gbd_fft_stages_neon(const gbd_fft_t *t, float *re, float *im)
+{
+	unsigned int h, b, k;
+
+	for (h = 4; h < t->m; h <<= 1) {
+		const float *wr = t->tw_re + h - 1, *wi = t->tw_im + h - 1;
+
+		for (b = 0; b < t->m; b += 2 * h)
+			for (k = 0; k < h; k += 4) {
+				float *ar = re + b + k, *ai = im + b + k;
+				float *br = ar + h, *bi = ai + h;
+				float32x4_t xr = vld1q_f32(wr + k);
+				float32x4_t xi = vld1q_f32(wi + k);
+				float32x4_t vbr = vld1q_f32(br), vbi = vld1q_f32(bi);
+				float32x4_t var = vld1q_f32(ar), vai = vld1q_f32(ai);
+				float32x4_t tr = vmlsq_f32(vmulq_f32(vbr, xr), vbi, xi);
+				float32x4_t ti = vmlaq_f32(vmulq_f32(vbr, xi), vbi, xr);
+
+				vst1q_f32(br, vsubq_f32(var, tr));
+				vst1q_f32(bi, vsubq_f32(vai, ti));
+				vst1q_f32(ar, vaddq_f32(var, tr));
+				vst1q_f32(ai, vaddq_f32(vai, ti));
+			}
+	}
+}
+#endif
+
+/*
+ * Z = the m point transform of z[j] = x[2j] + i x[2j + 1]; with
+ * Fe = (Z[k] + conj Z[m - k]) / 2 and Fo = (Z[k] - conj Z[m - k]) / 2i,
+ * X[k] = Fe + W^k Fo and X[m - k] = conj(Fe - W^k Fo), W = e^(-2 pi i / n)
+ */
+#ifdef GBD_FIXED
+/* as below, but on 2 Fe and 2 Fo, in 64 bits: 2 X is up to n * 2^16 */
+static void gbd_fft_split(const gbd_fft_t *t, uint64_t *pow)
+{
+	const int32_t *re = t->re, *im = t->im;
+	int64_t er, ei, fr, fi, pr, pi;
+	unsigned int k, j;
+
+	pow[0] = (uint64_t)(((int64_t)re[0] + im[0]) * ((int64_t)re[0] + im[0]));
+	pow[t->m] = (uint64_t)(((int64_t)re[0] - im[0]) *
+			       ((int64_t)re[0] - im[0]));
+	for (k = 1; k <= t->m / 2; k++) {
+		j = t->m - k;
+		er = (int64_t)re[k] + re[j];
+		ei = (int64_t)im[k] - im[j];
+		fr = (int64_t)im[k] + im[j];
+		fi = (int64_t)re[j] - re[k];
+		pr = (fr * t->sp_re[k] - fi * t->sp_im[k] + (1 << 14)) >> 15;
+		pi = (fr * t->sp_im[k] + fi * t->sp_re[k] + (1 << 14)) >> 15;
+		pow[k] = ((uint64_t)((er + pr) * (er + pr)) +
+			  (uint64_t)((ei + pi) * (ei + pi))) >> 2;
+		pow[j] = ((uint64_t)((er - pr) * (er - pr)) +
+			  (uint64_t)((ei - pi) * (ei - pi))) >> 2;
+	}
+}
+#else
+static void gbd_fft_split(const gbd_fft_t *t, float *pow)
+{
+	const float *re = t->re, *im = t->im;
+	unsigned int k, j;
+	float er, ei, fr, fi, pr, pi;
+
+	pow[0] = (re[0] + im[0]) * (re[0] + im[0]);
+	pow[t->m] = (re[0] - im[0]) * (re[0] - im[0]);
+	for (k = 1; k <= t->m / 2; k++) {
+		j = t->m - k;
+		er = 0.5f * (re[k] + re[j]);
+		ei = 0.5f * (im[k] - im[j]);
+		fr = 0.5f * (im[k] + im[j]);
+		fi = -0.5f * (re[k] - re[j]);
+		pr = fr * t->sp_re[k] - fi * t->sp_im[k];
+		pi = fr * t->sp_im[k] + fi * t->sp_re[k];
+		pow[k] = (er + pr) * (er + pr) + (ei + pi) * (ei + pi);
+		pow[j] = (er - pr) * (er - pr) + (ei - pi) * (ei - pi);
+	}
+}
+#endif
+
+void gbd_fft_power(gbd_fft_t *t, const gbd_fft_q_t *in, gbd_fft_pow_t *pow)
+{
+	unsigned int j;
+
+	for (j = 0; j < t->m; j++) {
+		t->re[t->bitrev[j]] = in[2 * j];
+		t->im[t->bitrev[j]] = in[2 * j + 1];
+	}
+	gbd_fft_radix4(t->re, t->im, t->m);
+	t->stages(t, t->re, t->im);
+	gbd_fft_split(t, pow);
+}
+
+static void gbd_fft_pick(gbd_fft_t *t)
+{
+	t->backend = "scalar";
+	t->stages = gbd_fft_stages_scalar;
+#if defined(GBD_FIXED)
+	t->backend = "q15";
+#elif defined(__SSE2__)
+	t->backend = "sse2";
+	t->stages = gbd_fft_stages_sse2;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx")) {
+		t->backend = "avx";
+		t->stages = gbd_fft_stages_avx;
+	}
+#elif defined(GBD_NEON)
+	t->backend = "neon";
+	t->stages = gbd_fft_stages_neon;
+#endif
+}
+
+/* ns per transform of the backend picked */
+static void gbd_fft_bench(gbd_fft_t *t, gbd_fft_q_t *in, gbd_fft_pow_t *pow)
+{
+	struct timespec t0, t1;
+	unsigned int i;
+
+	for (i = 0; i < t->n; i++)
+		in[i] = (gbd_fft_q_t)(((int)(i & 7) - 4) * 1024);
+	gbd_fft_power(t, in, pow);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < GBD_FFT_BENCH; i++)
+		gbd_fft_power(t, in, pow);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	t->ns = ((t1.tv_sec - t0.tv_sec) * 1000000000L +
+		 (t1.tv_nsec - t0.tv_nsec)) / GBD_FFT_BENCH;
+}
+
+int gbd_fft_init(gbd_fft_t *t, unsigned int n)
+{
+	unsigned int m = n / 2, h, k, j, bits;
+	gbd_fft_q_t *in;
+	gbd_fft_pow_t *pow;
+
+	memset(t, 0, sizeof(*t));
+	if (n < 16 || n > GBD_FFT_MAX || (n & (n - 1)))
+		return -EINVAL;
+	for (bits = 0; (1u << bits) < m; bits++)
+		;
+
+	t->n = n;
+	t->m = m;
+	t->tw_re = malloc(m * sizeof(gbd_fft_q_t));
+	t->tw_im = malloc(m * sizeof(gbd_fft_q_t));
+	t->sp_re = malloc(m * sizeof(gbd_fft_q_t));
+	t->sp_im = malloc(m * sizeof(gbd_fft_q_t));
+	t->bitrev = malloc(m * sizeof(uint32_t));
+	t->re = malloc(m * sizeof(gbd_fft_acc_t));
+	t->im = malloc(m * sizeof(gbd_fft_acc_t));
+	in = malloc(n * sizeof(gbd_fft_q_t));
+	pow = malloc((m + 1) * sizeof(gbd_fft_pow_t));
+	if (!t->tw_re || !t->tw_im || !t->sp_re || !t->sp_im ||
+	    !t->bitrev || !t->re || !t->im || !in || !pow) {
+		free(in);
+		free(pow);
+		gbd_fft_free(t);
+		return -ENOMEM;
+	}
+
+	for (j = 0; j < m; j++) {
+		for (k = 0, h = 0; k < bits; k++)
+			h |= ((j >> k) & 1) << (bits - 1 - k);
+		t->bitrev[j] = h;
+		t->sp_re[j] = gbd_fft_q(cosf(2.0f * (float)M_PI * j / n));
+		t->sp_im[j] = gbd_fft_q(-sinf(2.0f * (float)M_PI * j / n));
+	}
+
+	/* the twiddles of the stage combining h point transforms are
+	 * stored contiguously at offset h - 1 */
+	for (h = 1; h < m; h <<= 1)
+		for (k = 0; k < h; k++) {
+			t->tw_re[h - 1 + k] = gbd_fft_q(cosf((float)M_PI * k / h));
+			t->tw_im[h - 1 + k] = gbd_fft_q(-sinf((float)M_PI * k / h));
+		}
+
+	gbd_fft_pick(t);
+	gbd_fft_bench(t, in, pow);
+	free(in);
+	free(pow);
+	return 0;
+}
+
+void gbd_fft_free(gbd_fft_t *t)
+{
+	free(t->tw_re);
+	free(t->tw_im);
+	free(t->sp_re);
+	free(t->sp_im);
+	free(t->bitrev);
+	free(t->re);
+	free(t->im);
+	memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,95 @@
+/*
+ * file : gbd_fft.h
+ * desc : real input power spectrum transform for the gbd (Generic Beat
+ *        Detector) framework, with SIMD backends
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_FFT_H__
+#define __GBD_FFT_H__
+
+#include <stdint.h>
+
+/*
+ * The n real samples are transformed as n/2 complex ones (even samples
+ * real, odd ones imaginary) and the two interleaved spectra are split
+ * apart afterwards, which halves the work of a complex transform with
+ * zero imaginary parts. The n/2 point transform starts with a radix-4
+ * pass over the bit reversed input, whose twiddles are trivial; the
+ * radix-2 stages after it are where the backends differ:
+ *
+ *   scalar  everywhere
+ *   sse2    x86 (baseline on x86-64)
+ *   avx     x86, when the cpu has it (checked at gbd_fft_init())
+ *   neon    arm, when built for it (armv7 with -mfpu=neon, which
+ *           Makefile-arm-rpi adds on armv7l, or aarch64)
+ *   q15     built with GBD_FIXED, see below
+ *
+ * sse2 and neon are chosen at build time, avx on top of sse2 at run
+ * time: gbd_fft_init() takes the best one the cpu runs and times it,
+ * for the record; the results agree to float rounding across backends.
+ *
+ * GBD_FIXED builds (armv6, i.e. the Pi Zero and Pi 1, whose VFPv2 is
+ * slow and which have no NEON) transform in integers instead: samples
+ * and twiddles are Q15, the transform runs in 32 bits without scaling
+ * (the output of n Q15 samples is below n * 2^15, hence GBD_FFT_MAX)
+ * and the power comes out as a Q30 integer; gbd_features.h has how far
+ * that ends up from the float build.
+ */
+#ifdef GBD_FIXED
+typedef int16_t gbd_fft_q_t;		/* samples, twiddles: Q15 */
+typedef int32_t gbd_fft_acc_t;		/* transform */
+typedef uint64_t gbd_fft_pow_t;		/* power: Q30 */
+#define GBD_FFT_MAX 32768
+
+/* -1.0..1.0 to Q15, saturating */
+static inline gbd_fft_q_t gbd_fft_q(float x)
+{
+	x *= 32767.0f;
+	if (x >= 32767.0f)
+		return 32767;
+	if (x <= -32768.0f)
+		return -32768;
+	return (gbd_fft_q_t)(x < 0.0f ? x - 0.5f : x + 0.5f);
+}
+#else
+typedef float gbd_fft_q_t;
+typedef float gbd_fft_acc_t;
+typedef float gbd_fft_pow_t;
+#define GBD_FFT_MAX (1u << 24)
+
+static inline gbd_fft_q_t gbd_fft_q(float x)
+{
+	return x;
+}
+#endif
+
+typedef struct __gbd_fft gbd_fft_t;
+
+struct __gbd_fft {
+	unsigned int n;		/* real samples, power of two >= 16 */
+	unsigned int m;		/* complex points, n / 2 */
+	const char *backend;
+	unsigned int ns;	/* measured ns per transform */
+	void (*stages)(const gbd_fft_t *t, gbd_fft_acc_t *re,
+		       gbd_fft_acc_t *im);
+	gbd_fft_q_t *tw_re, *tw_im;	/* stage twiddles, see gbd_fft_init() */
+	gbd_fft_q_t *sp_re, *sp_im;	/* split twiddles, m */
+	uint32_t *bitrev;		/* m */
+	gbd_fft_acc_t *re, *im;		/* work area, m */
+};
+
+int gbd_fft_init(gbd_fft_t *t, unsigned int n);
+void gbd_fft_free(gbd_fft_t *t);
+
+/* |X[k]|^2 of the n samples at in, for k = 0..n/2 (n/2 + 1 values) */
+void gbd_fft_power(gbd_fft_t *t, const gbd_fft_q_t *in, gbd_fft_pow_t *pow);
+
+#endif /* __GBD_FFT_H__ */
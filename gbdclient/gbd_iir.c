@@ -0,0 +1,228 @@
+/*
+ * file : gbd_iir.c
+ * desc : time domain band-pass filterbank for the gbd (Generic Beat
+ *        Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "gbd_iir.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GBD_NEON 1
+#endif
+
+/* state this small is flushed to zero by gbd_iir_take(), before it
+ * decays into (slow) denormals */
+#define GBD_IIR_TINY 1e-25f
+
+int gbd_iir_init(gbd_iir_t *t, unsigned int rate, unsigned int bands,
+		 const float *lo, const float *hi)
+{
+	unsigned int b, s, lanes;
+	double w0, q, alpha, a0;
+	float *mem;
+
+	memset(t, 0, sizeof(*t));
+	if (!bands)
+		return -EINVAL;
+	for (b = 0; b < bands; b++)
+		if (lo[b] <= 0.0f || hi[b] <= lo[b] || hi[b] >= rate / 2.0f)
+			return -EINVAL;
+
+	lanes = (bands + GBD_IIR_LANES - 1) & ~(GBD_IIR_LANES - 1);
+	mem = calloc((5 * GBD_IIR_SECTIONS + 1) * lanes, sizeof(float));
+	if (!mem)
+		return -ENOMEM;
+	t->bands = bands;
+	t->lanes = lanes;
+	t->b0 = mem;
+	t->a1 = t->b0 + GBD_IIR_SECTIONS * lanes;
+	t->a2 = t->a1 + GBD_IIR_SECTIONS * lanes;
+	t->z1 = t->a2 + GBD_IIR_SECTIONS * lanes;
+	t->z2 = t->z1 + GBD_IIR_SECTIONS * lanes;
+	t->acc = t->z2 + GBD_IIR_SECTIONS * lanes;
+
+	/* designed in double, the narrow bass bands have their poles
+	 * right next to the unit circle */
+	for (b = 0; b < bands; b++) {
+		w0 = 2.0 * M_PI * sqrt((double)lo[b] * hi[b]) / rate;
+		q = sqrt((double)lo[b] * hi[b]) / (hi[b] - lo[b]);
+		alpha = sin(w0) / (2.0 * q);
+		a0 = 1.0 + alpha;
+		for (s = 0; s < GBD_IIR_SECTIONS; s++) {
+			t->b0[s * lanes + b] = alpha / a0;
+			t->a1[s * lanes + b] = -2.0 * cos(w0) / a0;
+			t->a2[s * lanes + b] = (1.0 - alpha) / a0;
+		}
+	}
+
+#if defined(__SSE2__)
+	t->backend = "sse2";
+#elif defined(GBD_NEON)
+	t->backend = "neon";
+#else
+	t->backend = "scalar";
+#endif
+	return 0;
+}
+
+void gbd_iir_free(gbd_iir_t *t)
+{
+	free(t->b0);
+	memset(t, 0, sizeof(*t));
+}
+
+/*
+ * Per section, y = b0 x + z1, z1 = z2 - a1 y, z2 = -b0 x - a2 y (the
+ * band-pass has b1 = 0 and b2 = -b0).
+ */
+#if defined(__SSE2__)
+void gbd_iir_run(gbd_iir_t *t, const float *x, size_t n)
+{
+	const unsigned int L = t->lanes;
+	unsigned int l;
+	size_t i;
+
+	for (l = 0; l < L; l += 4) {
+		const __m128 b0 = _mm_loadu_ps(t->b0 + l);
+		const __m128 a1 = _mm_loadu_ps(t->a1 + l);
+		const __m128 a2 = _mm_loadu_ps(t->a2 + l);
+		const __m128 c0 = _mm_loadu_ps(t->b0 + L + l);
+		const __m128 c1 = _mm_loadu_ps(t->a1 + L + l);
+		const __m128 c2 = _mm_loadu_ps(t->a2 + L + l);
+		__m128 z1 = _mm_loadu_ps(t->z1 + l);
+		__m128 z2 = _mm_loadu_ps(t->z2 + l);
+		__m128 w1 = _mm_loadu_ps(t->z1 + L + l);
+		__m128 w2 = _mm_loadu_ps(t->z2 + L + l);
+		__m128 acc = _mm_loadu_ps(t->acc + l);
+		__m128 v, bx, y;
+
+		for (i = 0; i < n; i++) {
+			bx = _mm_mul_ps(b0, _mm_set1_ps(x[i]));
+			v = _mm_add_ps(bx, z1);
+			z1 = _mm_sub_ps(z2, _mm_mul_ps(a1, v));
+			z2 = _mm_sub_ps(_mm_setzero_ps(),
+					_mm_add_ps(bx, _mm_mul_ps(a2, v)));
+
+			bx = _mm_mul_ps(c0, v);
+			y = _mm_add_ps(bx, w1);
+			w1 = _mm_sub_ps(w2, _mm_mul_ps(c1, y));
+			w2 = _mm_sub_ps(_mm_setzero_ps(),
+					_mm_add_ps(bx, _mm_mul_ps(c2, y)));
+
+			acc = _mm_add_ps(acc, _mm_mul_ps(y, y));
+		}
+		_mm_storeu_ps(t->z1 + l, z1);
+		_mm_storeu_ps(t->z2 + l, z2);
+		_mm_storeu_ps(t->z1 + L + l, w1);
+		_mm_storeu_ps(t->z2 + L + l, w2);
+		_mm_storeu_ps(t->acc + l, acc);
+	}
+}
+#elif defined(GBD_NEON)
+void gbd_iir_run(gbd_iir_t *t, const float *x, size_t n)
+{
+	const unsigned int L = t->lanes;
+	unsigned int l;
+	size_t i;
+
+	for (l = 0; l < L; l += 4) {
+		const float32x4_t b0 = vld1q_f32(t->b0 + l);
+		const float32x4_t a1 = vld1q_f32(t->a1 + l);
+		const float32x4_t a2 = vld1q_f32(t->a2 + l);
+		const float32x4_t c0 = vld1q_f32(t->b0 + L + l);
+		const float32x4_t c1 = vld1q_f32(t->a1 + L + l);
+		const float32x4_t c2 = vld1q_f32(t->a2 + L + l);
+		float32x4_t z1 = vld1q_f32(t->z1 + l);
+		float32x4_t z2 = vld1q_f32(t->z2 + l);
+		float32x4_t w1 = vld1q_f32(t->z1 + L + l);
+		float32x4_t w2 = vld1q_f32(t->z2 + L + l);
+		float32x4_t acc = vld1q_f32(t->acc + l);
+		float32x4_t v, bx, y;
+
+		for (i = 0; i < n; i++) {
+			bx = vmulq_n_f32(b0, x[i]);
+			v = vaddq_f32(bx, z1);
+			z1 = vmlsq_f32(z2, a1, v);
+			z2 = vnegq_f32(vmlaq_f32(bx, a2, v));
+
+			bx = vmulq_f32(c0, v);
+			y = vaddq_f32(bx, w1);
+			w1 = vmlsq_f32(w2, c1, y);
+			w2 = vnegq_f32(vmlaq_f32(bx, c2, y));
+
+			acc = vmlaq_f32(acc, y, y);
+		}
+		vst1q_f32(t->z1 + l, z1);
+		vst1q_f32(t->z2 + l, z2);
+		vst1q_f32(t->z1 + L + l, w1);
+		vst1q_f32(t->z2 + L + l, w2);
+		vst1q_f32(t->acc + l, acc);
+	}
+}
+#else
+void gbd_iir_run(gbd_iir_t *t, const float *x, size_t n)
+{
+	const unsigned int L = t->lanes;
+	float z1, z2, w1, w2, acc, v, bx, y;
+	unsigned int l;
+	size_t i;
+
+	for (l = 0; l < t->bands; l++) {
+		z1 = t->z1[l];
+		z2 = t->z2[l];
+		w1 = t->z1[L + l];
+		w2 = t->z2[L + l];
+		acc = t->acc[l];
+		for (i = 0; i < n; i++) {
+			bx = t->b0[l] * x[i];
+			v = bx + z1;
+			z1 = z2 - t->a1[l] * v;
+			z2 = -(bx + t->a2[l] * v);
+
+			bx = t->b0[L + l] * v;
+			y = bx + w1;
+			w1 = w2 - t->a1[L + l] * y;
+			w2 = -(bx + t->a2[L + l] * y);
+
+			acc += y * y;
+		}
+		t->z1[l] = z1;
+		t->z2[l] = z2;
+		t->z1[L + l] = w1;
+		t->z2[L + l] = w2;
+		t->acc[l] = acc;
+	}
+}
+#endif
+
+void gbd_iir_take(gbd_iir_t *t, float *out, unsigned int count)
+{
+	unsigned int b;
+
+	for (b = 0; b < t->bands; b++) {
+		out[b] = t->acc[b] / count;
+		t->acc[b] = 0.0f;
+	}
+	for (b = 0; b < GBD_IIR_SECTIONS * t->lanes; b++) {
+		if (fabsf(t->z1[b]) < GBD_IIR_TINY)
+			t->z1[b] = 0.0f;
+		if (fabsf(t->z2[b]) < GBD_IIR_TINY)
+			t->z2[b] = 0.0f;
+	}
+}
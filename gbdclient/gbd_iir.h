@@ -0,0 +1,59 @@
+/*
+ * file : gbd_iir.h
+ * desc : time domain band-pass filterbank for the gbd (Generic Beat
+ *        Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_IIR_H__
+#define __GBD_IIR_H__
+
+#include <stddef.h>
+
+/*
+ * Every band is two cascaded band-pass biquads (RBJ, 0 dB at the centre
+ * frequency, the geometric mean of the band edges, and -6 dB at the
+ * edges) run sample by sample, and the square of their output is summed
+ * until gbd_iir_take() hands out the mean. Nothing waits for a window to
+ * fill: an onset shows within the group delay of its band's filters,
+ * a few ms but for the narrow bass bands.
+ *
+ * The filter state is kept per band in GBD_IIR_LANES wide rows (the
+ * bands rounded up), and each group of lanes runs through a whole block
+ * of samples at once with its state in registers: with SSE2 or NEON a
+ * group of bands costs about what a single band does.
+ */
+#define GBD_IIR_LANES 4
+#define GBD_IIR_SECTIONS 2
+
+typedef struct __gbd_iir {
+	unsigned int bands;
+	unsigned int lanes;	/* bands rounded up to GBD_IIR_LANES */
+	const char *backend;
+	/* per section and lane, [section * lanes + band]; pads are zero */
+	float *b0;		/* b1 = 0, b2 = -b0 */
+	float *a1, *a2;
+	float *z1, *z2;		/* transposed direct form II state */
+	float *acc;		/* sum of squares, lanes */
+} gbd_iir_t;
+
+/* band b passes lo[b]..hi[b] Hz, 0 < lo < hi < rate / 2 */
+int gbd_iir_init(gbd_iir_t *t, unsigned int rate, unsigned int bands,
+		 const float *lo, const float *hi);
+void gbd_iir_free(gbd_iir_t *t);
+
+/* runs n mono samples through the bank */
+void gbd_iir_run(gbd_iir_t *t, const float *x, size_t n);
+
+/* the mean square of each band over the count samples run since the
+ * last call, bands floats at out */
+void gbd_iir_take(gbd_iir_t *t, float *out, unsigned int count);
+
+#endif /* __GBD_IIR_H__ */
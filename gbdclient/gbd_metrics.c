@@ -0,0 +1,177 @@
+/*
+ * file : gbd_metrics.c
+ * desc : lock-free counters, histograms and a local Prometheus text
+ *        endpoint for the gbd (Generic Beat Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "gbd_metrics.h"
+
+#define GBD_METRICS_HTTP "HTTP/1.0 200 OK\r\n" \
+	"Content-Type: text/plain; version=0.0.4\r\n\r\n"
+
+void gbd_hist_print(FILE *out, const char *name, const char *help,
+		    gbd_hist_t *h, double scale)
+{
+	unsigned long cum = 0;
+	int i;
+
+	fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	for (i = 0; i < GBD_HIST_BUCKETS - 1; i++) {
+		cum += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+		fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", name,
+			(double)(1UL << i) * scale, cum);
+	}
+	cum += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+	fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, cum);
+	fprintf(out, "%s_sum %.15g\n", name,
+		atomic_load_explicit(&h->sum, memory_order_relaxed) * scale);
+	fprintf(out, "%s_count %lu\n", name, cum);
+}
+
+void gbd_metric_print(FILE *out, const char *name, const char *type,
+		      const char *help, double value)
+{
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %.15g\n",
+		name, help, name, type, name, value);
+}
+
+/* answers one scrape; the text is put together first, so a peer that
+ * is gone only fails the send(2), without a SIGPIPE */
+static void gbd_metrics_serve(gbd_metrics_t *m, int c)
+{
+	struct timeval tv = { 0, 100000 };
+	char req[256], *buf = NULL;
+	size_t len = 0, off;
+	ssize_t n;
+	FILE *out;
+
+	/* a request, if any, is read and otherwise ignored */
+	setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	n = recv(c, req, sizeof(req), 0);
+
+	out = open_memstream(&buf, &len);
+	if (!out)
+		return;
+	if (n >= 4 && !memcmp(req, "GET ", 4))
+		fputs(GBD_METRICS_HTTP, out);
+	m->fn(out, m->ctx);
+	if (fclose(out) == 0)
+		for (off = 0; off < len; off += n) {
+			n = send(c, buf + off, len - off, MSG_NOSIGNAL);
+			if (n <= 0)
+				break;
+		}
+	free(buf);
+}
+
+static void *gbd_metrics_thread(void *arg)
+{
+	gbd_metrics_t *m = arg;
+	int c;
+
+	for (;;) {
+		c = accept(m->fd, NULL, NULL);
+		if (c < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			/* shut down by gbd_metrics_stop() */
+			break;
+		}
+		gbd_metrics_serve(m, c);
+		close(c);
+	}
+	return NULL;
+}
+
+/* whether an endpoint still accepts at addr, e.g. another gbdclient
+ * of the same .asoundrc; only a refused connect makes it stale */
+static int gbd_metrics_live(const struct sockaddr_un *addr)
+{
+	int fd, live;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return 1;
+	live = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0 ||
+	    errno != ECONNREFUSED;
+	close(fd);
+	return live;
+}
+
+int gbd_metrics_start(gbd_metrics_t *m, const char *path,
+		      gbd_metrics_fn fn, void *ctx)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int err;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* the socket of an earlier run, not any file by that name nor
+	 * the endpoint of a running one */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if (gbd_metrics_live(&addr))
+			return -EADDRINUSE;
+		unlink(path);
+	}
+
+	m->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m->fd < 0)
+		return -errno;
+	if (bind(m->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(m->fd, 4) < 0 || stat(path, &st) < 0) {
+		err = -errno;
+		close(m->fd);
+		m->fd = -1;
+		return err;
+	}
+	m->dev = st.st_dev;
+	m->ino = st.st_ino;
+	strcpy(m->path, path);
+	m->fn = fn;
+	m->ctx = ctx;
+	if (pthread_create(&m->thread, NULL, gbd_metrics_thread, m)) {
+		close(m->fd);
+		m->fd = -1;
+		unlink(path);
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+void gbd_metrics_stop(gbd_metrics_t *m)
+{
+	struct stat st;
+
+	if (m->fd < 0)
+		return;
+	/* wakes the accept(2) */
+	shutdown(m->fd, SHUT_RDWR);
+	pthread_join(m->thread, NULL);
+	close(m->fd);
+	m->fd = -1;
+	/* unless another instance has bound a socket there since */
+	if (stat(m->path, &st) == 0 && st.st_dev == m->dev &&
+	    st.st_ino == m->ino)
+		unlink(m->path);
+}
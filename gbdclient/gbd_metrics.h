@@ -0,0 +1,82 @@
+/*
+ * file : gbd_metrics.h
+ * desc : lock-free counters, histograms and a local Prometheus text
+ *        endpoint for the gbd (Generic Beat Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_METRICS_H__
+#define __GBD_METRICS_H__
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+/*
+ * Histograms with power of two buckets: bucket i counts the values up
+ * to 2^i (in the unit of the histogram), the last one the rest.
+ * Observing is three relaxed atomic adds, cheap enough for the alsa
+ * thread; a scrape may see count and buckets one observation apart.
+ * The sum is an unsigned long, so it wraps on 32-bit hosts like any
+ * other counter of theirs.
+ */
+#define GBD_HIST_BUCKETS 24
+
+typedef struct __gbd_hist {
+	atomic_ulong bucket[GBD_HIST_BUCKETS];
+	atomic_ulong count;
+	atomic_ulong sum;
+} gbd_hist_t;
+
+static inline void gbd_hist_observe(gbd_hist_t *h, unsigned long v)
+{
+	int i = v <= 1 ? 0 : (int)(8 * sizeof(long)) - __builtin_clzl(v - 1);
+
+	if (i >= GBD_HIST_BUCKETS)
+		i = GBD_HIST_BUCKETS - 1;
+	atomic_fetch_add_explicit(&h->bucket[i], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+}
+
+/* Prometheus text exposition; scale converts the histogram unit to the
+ * metric's base unit, e.g. 1e-6 for a us histogram of seconds */
+void gbd_hist_print(FILE *out, const char *name, const char *help,
+		    gbd_hist_t *h, double scale);
+void gbd_metric_print(FILE *out, const char *name, const char *type,
+		      const char *help, double value);
+
+/*
+ * Endpoint: a thread accepting on a unix socket and answering every
+ * connection with the text fn writes, behind an HTTP/1.0 header if
+ * the peer sent a GET (curl --unix-socket), plain otherwise (socat).
+ * It only runs when scraped, so it costs nothing in between.
+ */
+typedef void (*gbd_metrics_fn)(FILE *out, void *ctx);
+
+typedef struct __gbd_metrics {
+	int fd;
+	pthread_t thread;
+	gbd_metrics_fn fn;
+	void *ctx;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	dev_t dev;		/* of the socket bound at path */
+	ino_t ino;
+} gbd_metrics_t;
+
+/* -EADDRINUSE if another endpoint is live at path; a stale socket
+ * there, left by a run that died, is replaced */
+int gbd_metrics_start(gbd_metrics_t *m, const char *path,
+		      gbd_metrics_fn fn, void *ctx);
+void gbd_metrics_stop(gbd_metrics_t *m);
+
+#endif /* __GBD_METRICS_H__ */
@@ -0,0 +1,166 @@
+/*
+ * file : gbd_mix.c
+ * desc : multichannel downmix for the analysis stream of the gbd
+ *        (Generic Beat Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include "gbd_mix.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GBD_NEON 1
+#endif
+
+#define GBD_MIX_3DB 0.70710678f
+
+int gbd_mix_init(gbd_mix_t *mx, unsigned int in, unsigned int out,
+		 const float *gains)
+{
+	unsigned int c, m;
+
+	if (!in || in > GBD_CHANNELS_MAX || !out || out > GBD_MIX_OUT_MAX)
+		return -EINVAL;
+	memset(mx, 0, sizeof(*mx));
+	mx->in = in;
+	mx->out = out;
+	for (m = 0; m < out; m++)
+		for (c = 0; c < in; c++)
+			mx->col[c][m] = gains[m * in + c];
+	return 0;
+}
+
+int gbd_mix_lfe(unsigned int in)
+{
+	switch (in) {
+	case 3:
+		return 2;
+	case 6:
+	case 7:
+	case 8:
+		return 5;
+	default:
+		return -1;
+	}
+}
+
+int gbd_mix_default(gbd_mix_t *mx, unsigned int in, int lfe, float lfe_gain)
+{
+	float g[2][GBD_CHANNELS_MAX], sum;
+	unsigned int c, m;
+
+	if (!in || in > GBD_CHANNELS_MAX)
+		return -EINVAL;
+	memset(g, 0, sizeof(g));
+	if (in == 1) {
+		g[0][0] = g[1][0] = 1.0f;
+	} else {
+		g[0][0] = g[1][1] = 1.0f;
+		/* rears (surround on 4.0/5.x), centre, sides, back centre */
+		if (in >= 4)
+			g[0][2] = g[1][3] = GBD_MIX_3DB;
+		if (in >= 5)
+			g[0][4] = g[1][4] = GBD_MIX_3DB;
+		if (in == 7)
+			g[0][6] = g[1][6] = 0.5f;
+		if (in == 8)
+			g[0][6] = g[1][7] = GBD_MIX_3DB;
+		if (lfe >= 0 && lfe < (int)in)
+			g[0][lfe] = g[1][lfe] = lfe_gain;
+	}
+
+	for (m = 0; m < 2; m++) {
+		for (sum = 0.0f, c = 0; c < in; c++)
+			sum += g[m][c] < 0.0f ? -g[m][c] : g[m][c];
+		if (sum > 1.0f)
+			for (c = 0; c < in; c++)
+				g[m][c] /= sum;
+	}
+
+	memset(mx, 0, sizeof(*mx));
+	mx->in = in;
+	mx->out = 2;
+	for (m = 0; m < 2; m++)
+		for (c = 0; c < in; c++)
+			mx->col[c][m] = g[m][c];
+	return 0;
+}
+
+int gbd_mix_add_lfe(gbd_mix_t *mx, int lfe)
+{
+	unsigned int c;
+
+	if (lfe < 0 || lfe >= (int)mx->in || mx->out == GBD_MIX_OUT_MAX)
+		return -EINVAL;
+	for (c = 0; c < mx->in; c++)
+		mx->col[c][mx->out] = (int)c == lfe ? 1.0f : 0.0f;
+	mx->out++;
+	return 0;
+}
+
+static void gbd_mix_frame(const gbd_mix_t *mx, float *dst, const float *src)
+{
+	unsigned int c, m;
+	float acc;
+
+	for (m = 0; m < mx->out; m++) {
+		for (acc = 0.0f, c = 0; c < mx->in; c++)
+			acc += src[c] * mx->col[c][m];
+		dst[m] = acc;
+	}
+}
+
+/*
+ * The vector paths compute all outputs of a frame in one register and
+ * store the whole register; the lanes past mx->out spill into the
+ * next frame's slots, which the next frame overwrites. The last
+ * frames, where that would run past dst, take the scalar path.
+ */
+void gbd_mix_apply(const gbd_mix_t *mx, float *dst, const float *src,
+		   size_t frames)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	unsigned int c;
+
+	for (; (frames - i) * mx->out >= GBD_MIX_OUT_MAX; i++) {
+		__m128 acc = _mm_mul_ps(_mm_set1_ps(src[0]),
+					_mm_load_ps(mx->col[0]));
+		for (c = 1; c < mx->in; c++)
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(src[c]),
+							 _mm_load_ps(mx->col[c])));
+		_mm_storeu_ps(dst, acc);
+		src += mx->in;
+		dst += mx->out;
+	}
+#elif defined(GBD_NEON)
+	unsigned int c;
+
+	for (; (frames - i) * mx->out >= GBD_MIX_OUT_MAX; i++) {
+		float32x4_t acc = vmulq_n_f32(vld1q_f32(mx->col[0]), src[0]);
+		for (c = 1; c < mx->in; c++)
+			acc = vmlaq_n_f32(acc, vld1q_f32(mx->col[c]), src[c]);
+		vst1q_f32(dst, acc);
+		src += mx->in;
+		dst += mx->out;
+	}
+#endif
+	for (; i < frames; i++) {
+		gbd_mix_frame(mx, dst, src);
+		src += mx->in;
+		dst += mx->out;
+	}
+}
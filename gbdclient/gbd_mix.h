@@ -0,0 +1,53 @@
+/*
+ * file : gbd_mix.h
+ * desc : multichannel downmix for the analysis stream of the gbd
+ *        (Generic Beat Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_MIX_H__
+#define __GBD_MIX_H__
+
+#include <stddef.h>
+
+#define GBD_CHANNELS_MAX 8
+#define GBD_MIX_OUT_MAX 4
+
+/*
+ * out = M x in matrix applied to every interleaved frame. The gains
+ * are kept by input channel (col[c][m] is the share of input c in
+ * output m), so a frame is mixed with one vector multiply-add per
+ * input channel. Input channels follow the alsa order: FL FR RL RR
+ * FC LFE SL SR (2.1 is FL FR LFE).
+ */
+typedef struct __gbd_mix {
+	unsigned int in;
+	unsigned int out;
+	float col[GBD_CHANNELS_MAX][GBD_MIX_OUT_MAX] __attribute__((aligned(16)));
+} gbd_mix_t;
+
+/* gains: out rows of in gains each */
+int gbd_mix_init(gbd_mix_t *mx, unsigned int in, unsigned int out,
+		 const float *gains);
+
+/* stereo downmix of the usual layouts, LFE (if any) at lfe_gain;
+ * rows are scaled down to unity gain at most */
+int gbd_mix_default(gbd_mix_t *mx, unsigned int in, int lfe, float lfe_gain);
+
+/* appends an output carrying input channel lfe alone */
+int gbd_mix_add_lfe(gbd_mix_t *mx, int lfe);
+
+/* the LFE input of the usual layouts, or -1 */
+int gbd_mix_lfe(unsigned int in);
+
+void gbd_mix_apply(const gbd_mix_t *mx, float *dst, const float *src,
+		   size_t frames);
+
+#endif /* __GBD_MIX_H__ */
@@ -0,0 +1,213 @@
+/*
+ * file : gbd_proto.h
+ * desc : gbdclient <-> gbdserver wire protocol of the gbd (Generic Beat
+ *        Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_PROTO_H__
+#define __GBD_PROTO_H__
+
+#include <stdint.h>
+
+/* GBD command passing */
+#define GBD_ERROR -1
+#define GBD_SUCCESS 0
+#define GBD_LADSPA_LIB_INIT 1
+#define GBD_CLIENT_CHANNELS 2
+#define GBD_AUDIO_SAMPLE_RATE 3
+#define GBD_PCM_PLUGIN_INIT 4
+#define GBD_BEAT_DETECTION_FUNC 5
+#define GBD_PCM_PLUGIN_CLOSE 6
+/* optional, only sent when configured in .asoundrc; the gbdserver
+ * shipped so far skips them without a reply, so the client gives up
+ * on the reply after GBD_OFFER_TIMEOUT (gbdclient.c), takes the offer
+ * as declined and does not make it to that gbdserver again */
+#define GBD_PCM_ENCODING 7
+#define GBD_BEAT_DETECTION_PACKED 8
+#define GBD_PCM_TRANSPORT 9
+#define GBD_FEATURE_MODE 10	/* not sent, see below */
+#define GBD_BEAT_FEATURES 11
+typedef struct __gbd_msg {
+	/* note: declare strict types to avoid
+	 *       problems when executing on
+	 *       a 64-bit gbdclient host OS ...
+	 *       recall that the gbdserver on
+	 *       the raspberry pi is 32-bit */
+	int32_t cmd;
+	int32_t data;
+} gbd_msg_t;
+
+/* GBD_PCM_TRANSPORT data; the gbdserver answers GBD_SUCCESS with a
+ * session id in msg.data, or GBD_ERROR to keep the audio on TCP */
+#define GBD_TRANSPORT_TCP 0
+#define GBD_TRANSPORT_UDP 1
+#define GBD_TRANSPORT_SHM 2
+
+/* UDP transport: the control messages stay on the TCP connection,
+ * the audio goes to the same port number over UDP. Each datagram is
+ * a GBD_BEAT_DETECTION_FUNC or GBD_BEAT_DETECTION_PACKED message with
+ * an extended header, and fits a 1500 byte MTU. Datagrams may be lost,
+ * reordered or duplicated: the receiver must not wait for what is
+ * missing but conceal the gap in seq (zero-fill or repeat the previous
+ * samples) and go on, and discard whatever arrives behind the highest
+ * seq seen. A late datagram was counted lost when it was skipped, a
+ * duplicate was not, so telling them apart for the loss count takes
+ * a record of the seqs received lately (e.g. a 64 bit mask). */
+#define GBD_DGRAM_MAX 1472
+typedef struct __gbd_dgram {
+	int32_t cmd;
+	int32_t data;
+	int32_t session;	/* from the GBD_PCM_TRANSPORT reply */
+	uint32_t seq;		/* per session datagram counter */
+	int64_t tstamp;		/* client capture time, CLOCK_MONOTONIC ns */
+} gbd_dgram_t;
+
+/* Shared memory transport (gbd_shm.h): GBD_TRANSPORT_SHM is followed
+ * by a gbd_shm_cfg_t, which the gbdserver reads before answering, also
+ * when declining. Once accepted, the audio is committed to the ring as
+ * gbd_period_t records and the control messages stay on the socket; on
+ * GBD_PCM_PLUGIN_CLOSE the gbdserver drains the ring first. */
+#define GBD_SHM_NAME_MAX 32
+typedef struct __gbd_shm_cfg {
+	char name[GBD_SHM_NAME_MAX];	/* shm_open(3) name, nul terminated */
+	uint32_t bytes;			/* length of the mapping */
+	uint32_t reserved;
+} gbd_shm_cfg_t;
+
+typedef struct __gbd_period {
+	int64_t tstamp;		/* client capture time, CLOCK_MONOTONIC ns */
+	uint32_t frames;
+	uint32_t seq;		/* per session record counter */
+	float pcm[];		/* interleaved */
+} gbd_period_t;
+
+/* Edge feature extraction: GBD_HELLO_FEATURES, with a gbd_feature_cfg_t
+ * in the hello, asks the gbdserver to run its detector on band energies
+ * computed by the client. It is offered in protocol v2 only: a v1
+ * GBD_FEATURE_MODE followed by the configuration would be read by a
+ * gbdserver that does not know it as more commands, the bands and hop
+ * fields often making real ones. Once accepted, the client sends
+ * GBD_BEAT_FEATURES messages instead of PCM: msg.data feature vectors
+ * of cfg.bands floats each, one vector per cfg.hop frames, bands log
+ * spaced between cfg.fmin and cfg.fmax and holding the mean power of
+ * their transform bins. A cfg.size of 0 stands for a time domain
+ * filterbank instead of a transform: a band then holds the mean square
+ * of its band-pass filter's output over the hop. */
+typedef struct __gbd_feature_cfg {
+	int32_t bands;
+	int32_t hop;		/* frames */
+	int32_t size;		/* transform length, frames; 0: filterbank */
+	float fmin;
+	float fmax;
+} gbd_feature_cfg_t;
+
+/*
+ * Protocol v2: one GBD_HELLO frame (msg.data holds the size of the
+ * gbd_hello_t that follows) stands for the whole v1 sequence from
+ * GBD_LADSPA_LIB_INIT to GBD_PCM_PLUGIN_INIT, optional offers
+ * included, and gets one reply: a gbd_msg_t whose msg.data holds the
+ * size of the gbd_hello_reply_t that follows, or GBD_ERROR if the
+ * plugin cannot be initialized. The reply carries what the gbdserver
+ * settled on; features win over the transport and encoding offers, as
+ * they do in v1; its version is GBD_PROTO_VERSION or later. The
+ * gbdserver shipped so far does not know GBD_HELLO: it logs the
+ * unknown request and goes on reading the gbd_hello_t as gbd_msg_t
+ * commands, running those some fields happen to make (version and
+ * channels make a GBD_CLIENT_CHANNELS, a udp transport in a cmd slot a
+ * GBD_LADSPA_LIB_INIT, 4 bands a GBD_PCM_PLUGIN_INIT) and answering
+ * them, and keeps the connection open. So the client takes no reply
+ * within 1 s, or any reply but a GBD_SUCCESS with a whole
+ * gbd_hello_reply_t of a v2 version, for a v1 gbdserver: it
+ * reconnects, speaks v1 and remembers that gbdserver for the life of
+ * the process. A v2 gbdserver keeps accepting the v1 sequence from
+ * older clients.
+ *
+ * With GBD_HELLO_TSTAMP accepted, the audio messages on the TCP
+ * connection carry a gbd_dgram_t header in place of the gbd_msg_t, so
+ * a v2 gbdserver gets capture timestamps whatever the transport and
+ * may pace its analysis on them rather than on arrival.
+ * GBD_HELLO_FEATURE_TSTAMP does the same for the GBD_BEAT_FEATURES
+ * messages: tstamp is then the capture time of the frame completing
+ * the message's first vector, the next ones following cfg.hop frames
+ * apart, so that onsets can be placed to the hop rather than to the
+ * alsa period the vectors were computed in.
+ *
+ * With GBD_HELLO_FEATURE_BANDS the hello (and msg.data) is followed by
+ * cfg.bands gbd_band_cfg_t: the vectors then hold these bands, in this
+ * order, in place of the log spaced ones, and the gbdserver runs a
+ * detector per band with its threshold and history and publishes its
+ * count at BAND_COUNT(b) of the segment (maker-templates/gbd.h). If the
+ * reply lacks the flag, the client sends the log spaced bands that cfg
+ * describes.
+ *
+ * A stream of other than two channels (stereo and a forwarded LFE)
+ * is only sent with GBD_HELLO_CHANNELS accepted: the gbdserver shipped
+ * so far reads two channels per frame whatever GBD_CLIENT_CHANNELS
+ * says, so without the flag the client drops the extra channel and
+ * starts over on a fresh connection with a stereo hello.
+ *
+ * A named stream has its counts published in its own segment and
+ * listed in the stream registry (both in maker-templates/gbd.h); v1
+ * streams are unnamed. The gbdserver shipped so far speaks v1 only
+ * and writes neither.
+ */
+#define GBD_HELLO 12
+#define GBD_PROTO_VERSION 2
+#define GBD_HELLO_FEATURES 0x1
+#define GBD_HELLO_DELAY 0x2
+#define GBD_HELLO_TSTAMP 0x4	/* tcp audio with gbd_dgram_t headers */
+#define GBD_HELLO_FEATURE_TSTAMP 0x8	/* feature vectors too */
+#define GBD_HELLO_FEATURE_BANDS 0x10	/* band table after the hello */
+#define GBD_HELLO_CHANNELS 0x20	/* channels other than two */
+#define GBD_STREAM_NAME_MAX 32
+
+typedef struct __gbd_hello {
+	int32_t version;		/* GBD_PROTO_VERSION */
+	int32_t channels;
+	int32_t rate;
+	int32_t encoding;		/* wire encoding offered */
+	int32_t transport;		/* GBD_TRANSPORT_* offered */
+	int32_t flags;			/* GBD_HELLO_* offered */
+	gbd_feature_cfg_t features;	/* with GBD_HELLO_FEATURES */
+	gbd_shm_cfg_t shm;		/* with GBD_TRANSPORT_SHM */
+	char stream[GBD_STREAM_NAME_MAX];	/* nul terminated, "" if unnamed */
+} gbd_hello_t;
+
+typedef struct __gbd_band_cfg {
+	float fmin;		/* Hz */
+	float fmax;
+	float threshold;	/* energy over its history mean for an onset,
+				 * 0 for the gbdserver's default */
+	int32_t history;	/* vectors, 0 for the gbdserver's default */
+} gbd_band_cfg_t;
+
+typedef struct __gbd_hello_reply {
+	int32_t version;
+	int32_t encoding;		/* accepted, else float */
+	int32_t transport;		/* accepted, else tcp */
+	int32_t flags;			/* GBD_HELLO_* accepted */
+	int32_t session;		/* with GBD_TRANSPORT_UDP */
+	int32_t reserved;
+} gbd_hello_reply_t;
+
+/*
+ * Output latency (v2, with GBD_HELLO_DELAY accepted): GBD_OUTPUT_DELAY
+ * carries in msg.data how long, in us, audio handed to the alsa slave
+ * now takes to be heard; it is sent ahead of the audio whenever it
+ * changed, about twice a second at most. A period captured at
+ * tstamp is heard at tstamp + delay, so the gbdserver publishes the
+ * current delay in the OUTPUT_DELAY_US slot of the beat count segment
+ * (maker-templates/gbd.h), and consumers hold their effects back by
+ * that much after a count changes.
+ */
+#define GBD_OUTPUT_DELAY 13
+
+#endif /* __GBD_PROTO_H__ */
@@ -0,0 +1,136 @@
+/*
+ * file : gbd_ring.h
+ * desc : lock-free single-producer/single-consumer record ring for the
+ *        gbd (Generic Beat Detector) framework
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_RING_H__
+#define __GBD_RING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* Records are stored contiguously, each one behind a GBD_RING_HDR byte
+ * header holding its 32-bit length, and padded so that every record,
+ * and so every payload, starts GBD_RING_ALIGN byte aligned; payloads
+ * may hold 64-bit members (gbd_period_t does). This is the layout of
+ * the shm transport too (gbd_shm.h). A record that would straddle the end of the buffer is
+ * preceded by a wrap marker and restarts at offset 0, so the consumer
+ * always sees a record as one contiguous block (i.e. a single iovec).
+ *
+ * The head and tail indices are free-running 32-bit counters; the
+ * buffer size must be a power of two. Only the producer stores the
+ * head and only the consumer stores the tail, hence no locks. */
+#define GBD_RING_ALIGN 8
+#define GBD_RING_HDR GBD_RING_ALIGN	/* length, then padding */
+#define GBD_RING_WRAP 0xffffffffu
+
+typedef struct __gbd_ring {
+	_Atomic uint32_t head;	/* producer position */
+	_Atomic uint32_t tail;	/* consumer position */
+	uint32_t size;		/* data bytes, power of two */
+	uint32_t reserved;
+	uint8_t data[] __attribute__((aligned(GBD_RING_ALIGN)));
+} gbd_ring_t;
+
+static inline uint32_t gbd_ring_recsize(uint32_t len)
+{
+	return (GBD_RING_HDR + len + GBD_RING_ALIGN - 1) &
+	    ~(uint32_t)(GBD_RING_ALIGN - 1);
+}
+
+static inline size_t gbd_ring_bytes(uint32_t size)
+{
+	return sizeof(gbd_ring_t) + size;
+}
+
+static inline void gbd_ring_init(gbd_ring_t *r, uint32_t size)
+{
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	r->size = size;
+	r->reserved = 0;
+}
+
+/* bytes currently queued (callable from either side) */
+static inline uint32_t gbd_ring_fill(gbd_ring_t *r)
+{
+	return atomic_load_explicit(&r->head, memory_order_acquire) -
+	    atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+/*
+ * producer side: returns room for a len byte record, or NULL if the
+ * ring is full; the record becomes visible on gbd_ring_commit()
+ */
+static inline void *gbd_ring_reserve(gbd_ring_t *r, uint32_t len)
+{
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	uint32_t pos = head & (r->size - 1);
+	uint32_t rec = gbd_ring_recsize(len);
+	uint32_t skip = (pos + rec > r->size) ? r->size - pos : 0;
+
+	if (rec > r->size || (head - tail) + skip + rec > r->size)
+		return NULL;
+
+	if (skip) {
+		*(uint32_t *)(r->data + pos) = GBD_RING_WRAP;
+		head += skip;
+		atomic_store_explicit(&r->head, head, memory_order_release);
+		pos = 0;
+	}
+	*(uint32_t *)(r->data + pos) = len;
+	return r->data + pos + GBD_RING_HDR;
+}
+
+static inline void gbd_ring_commit(gbd_ring_t *r, uint32_t len)
+{
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	atomic_store_explicit(&r->head, head + gbd_ring_recsize(len),
+			      memory_order_release);
+}
+
+/*
+ * consumer side: returns the record at *pos and advances *pos past it,
+ * or NULL once the ring is drained; the records walked so far are
+ * handed back to the producer with gbd_ring_release()
+ */
+static inline void *gbd_ring_next(gbd_ring_t *r, uint32_t *pos, uint32_t *len)
+{
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	uint32_t off;
+
+	for (;;) {
+		if (*pos == head)
+			return NULL;
+		off = *pos & (r->size - 1);
+		*len = *(uint32_t *)(r->data + off);
+		if (*len != GBD_RING_WRAP)
+			break;
+		*pos += r->size - off;
+	}
+	*pos += gbd_ring_recsize(*len);
+	return r->data + off + GBD_RING_HDR;
+}
+
+static inline uint32_t gbd_ring_read_pos(gbd_ring_t *r)
+{
+	return atomic_load_explicit(&r->tail, memory_order_relaxed);
+}
+
+static inline void gbd_ring_release(gbd_ring_t *r, uint32_t pos)
+{
+	atomic_store_explicit(&r->tail, pos, memory_order_release);
+}
+
+#endif /* __GBD_RING_H__ */
@@ -0,0 +1,78 @@
+/*
+ * file : gbd_shm.h
+ * desc : shared memory period ring of the gbd (Generic Beat Detector)
+ *        framework, for a gbdclient and gbdserver on the same host
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_SHM_H__
+#define __GBD_SHM_H__
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "gbd_ring.h"
+#include "gbd_proto.h"
+
+/*
+ * The client shm_open()s and maps the segment, announces its name with
+ * GBD_PCM_TRANSPORT (see gbd_proto.h) and from then on commits every
+ * period straight into the ring as a gbd_period_t record; no socket
+ * calls per period. The ring itself is a gbd_ring_t placed at
+ * GBD_SHM_RING, the wakeup is a futex on the wake counter, which the
+ * producer bumps for every record and only FUTEX_WAKEs while the
+ * consumer has declared itself waiting. The consumer reads the wake
+ * counter, and only if the ring is empty sets waiting, checks the ring
+ * once more and FUTEX_WAITs on the value it read: a record committed
+ * meanwhile has moved the counter on, so the wait returns at once and
+ * no wakeup is lost.
+ */
+#define GBD_SHM_MAGIC 0x4d485347u	/* "GSHM" */
+#define GBD_SHM_VERSION 1
+#define GBD_SHM_RING 64
+
+/* the ring records are gbd_period_t, tstamp first */
+_Static_assert(_Alignof(gbd_period_t) <= GBD_RING_ALIGN &&
+	       GBD_SHM_RING % GBD_RING_ALIGN == 0,
+	       "gbd_period_t records would be misaligned in the ring");
+
+typedef struct __gbd_shm {
+	uint32_t magic;
+	uint32_t version;
+	int32_t channels;
+	int32_t rate;
+	_Atomic uint32_t wake;		/* futex word */
+	_Atomic uint32_t waiting;	/* consumer in FUTEX_WAIT */
+	_Atomic uint32_t dropped;	/* records lost to a full ring */
+	uint32_t reserved;
+} gbd_shm_t;
+
+static inline gbd_ring_t *gbd_shm_ring(gbd_shm_t *s)
+{
+	return (gbd_ring_t *)((uint8_t *)s + GBD_SHM_RING);
+}
+
+static inline size_t gbd_shm_bytes(uint32_t size)
+{
+	return GBD_SHM_RING + gbd_ring_bytes(size);
+}
+
+/* producer side, after gbd_ring_commit() */
+static inline void gbd_shm_wake(gbd_shm_t *s)
+{
+	atomic_fetch_add(&s->wake, 1);
+	if (atomic_load(&s->waiting))
+		syscall(SYS_futex, &s->wake, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+#endif /* __GBD_SHM_H__ */
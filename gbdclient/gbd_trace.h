@@ -0,0 +1,174 @@
+/*
+ * file : gbd_trace.h
+ * desc : end-to-end latency tracing of the gbd (Generic Beat Detector)
+ *        framework, from the gbdclient to the beat count consumers
+ *
+ * This file is a part of the GBD framework,
+ * https://github.com/generic-beat-detector/GBD
+ *
+ * Copyright (c) GBD,
+ * generic.beat.detector@gmail.com
+ *
+ * The program in this file is licensed under the terms of the MIT license.
+ */
+
+#ifndef __GBD_TRACE_H__
+#define __GBD_TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * A traced process records the stages periods go through in its own
+ * POSIX SHM buffer, GBD_TRACE_PREFIX "<pid>", which gbd-trace
+ * (maker-templates) dumps as Chrome/Perfetto trace JSON, stage to stage
+ * latencies included. A period is identified by its stream and the seq
+ * of its first message (gbd_dgram_t, or gbd_period_t on shm; see
+ * gbd_proto.h): the gbdclient records capture and send, the gbdserver
+ * receive, dsp start and end, and publish, together with the seq in the
+ * TRACE_SEQ slot of the beat count segment (maker-templates/gbd.h), so
+ * that consumers can record when they observe a count change and when
+ * their output reflects it. The timestamps are CLOCK_MONOTONIC, i.e.
+ * they only line up for processes on the same host. Seqs restart with
+ * every connection, so a buffer is best dumped while the run is live.
+ *
+ * The buffer is a ring of the latest GBD_TRACE_EVENTS events that any
+ * thread may append to without locks; an event's stamp is zero while
+ * it is being written and then its position + 1, so a reader copying
+ * the ring concurrently can tell complete events from torn ones.
+ */
+#define GBD_TRACE_PREFIX "gbd-trace-"
+#define GBD_TRACE_MAGIC 0x54524247u	/* "GBRT" */
+#define GBD_TRACE_EVENTS 16384		/* power of two */
+#define GBD_TRACE_NAME_MAX 32
+
+#define GBD_TRACE_CAPTURE 0	/* gbdclient: period handed over by alsa */
+#define GBD_TRACE_SEND 1	/* gbdclient: period written out */
+#define GBD_TRACE_RECEIVE 2	/* gbdserver: period read */
+#define GBD_TRACE_DSP_START 3	/* gbdserver: analysis */
+#define GBD_TRACE_DSP_END 4
+#define GBD_TRACE_PUBLISH 5	/* gbdserver: counts and TRACE_SEQ stored */
+#define GBD_TRACE_OBSERVE 6	/* consumer: count change seen */
+#define GBD_TRACE_OUTPUT 7	/* consumer: effect out, e.g. led frame */
+#define GBD_TRACE_STAGES 8
+
+typedef struct __gbd_trace_event {
+	_Atomic uint32_t stamp;		/* position + 1, 0 while written */
+	uint32_t seq;			/* period */
+	int64_t ts;			/* CLOCK_MONOTONIC ns */
+	int32_t stage;			/* GBD_TRACE_* */
+	int32_t reserved;
+} gbd_trace_event_t;
+
+typedef struct __gbd_trace {
+	uint32_t magic;
+	int32_t pid;
+	char name[GBD_TRACE_NAME_MAX];		/* process, e.g. "gbdclient" */
+	char stream[GBD_TRACE_NAME_MAX];	/* "" if unnamed */
+	_Atomic uint32_t head;			/* events appended */
+	uint32_t nevents;
+	gbd_trace_event_t ev[];
+} gbd_trace_t;
+
+static inline int64_t gbd_trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* appends an event; a no-op without a buffer */
+static inline void gbd_trace(gbd_trace_t *t, int stage, uint32_t seq,
+			     int64_t ts)
+{
+	gbd_trace_event_t *e;
+	uint32_t pos;
+
+	if (!t)
+		return;
+	pos = atomic_fetch_add_explicit(&t->head, 1, memory_order_relaxed);
+	e = &t->ev[pos & (t->nevents - 1)];
+	atomic_store_explicit(&e->stamp, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	e->seq = seq;
+	e->ts = ts;
+	e->stage = stage;
+	e->reserved = 0;
+	atomic_store_explicit(&e->stamp, pos + 1, memory_order_release);
+}
+
+/* reader side: copies event pos; 0 if it was overwritten or torn */
+static inline int gbd_trace_read(gbd_trace_t *t, uint32_t pos,
+				 gbd_trace_event_t *out)
+{
+	gbd_trace_event_t *e = &t->ev[pos & (t->nevents - 1)];
+	uint32_t stamp;
+
+	stamp = atomic_load_explicit(&e->stamp, memory_order_acquire);
+	out->seq = e->seq;
+	out->ts = e->ts;
+	out->stage = e->stage;
+	atomic_thread_fence(memory_order_acquire);
+	return stamp == pos + 1 &&
+	    atomic_load_explicit(&e->stamp, memory_order_relaxed) == stamp;
+}
+
+static inline size_t gbd_trace_bytes(uint32_t nevents)
+{
+	return sizeof(gbd_trace_t) + nevents * sizeof(gbd_trace_event_t);
+}
+
+/* creates and maps this process's buffer; NULL on failure */
+static inline gbd_trace_t *gbd_trace_open(const char *name,
+					  const char *stream)
+{
+	size_t bytes = gbd_trace_bytes(GBD_TRACE_EVENTS);
+	char path[sizeof(GBD_TRACE_PREFIX) + 16];
+	gbd_trace_t *t;
+	int fd;
+
+	snprintf(path, sizeof(path), "/" GBD_TRACE_PREFIX "%d", (int)getpid());
+	fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, bytes) < 0) {
+		close(fd);
+		shm_unlink(path);
+		return NULL;
+	}
+	t = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (t == MAP_FAILED) {
+		shm_unlink(path);
+		return NULL;
+	}
+	t->pid = getpid();
+	snprintf(t->name, sizeof(t->name), "%s", name);
+	snprintf(t->stream, sizeof(t->stream), "%s", stream ? stream : "");
+	atomic_init(&t->head, 0);
+	t->nevents = GBD_TRACE_EVENTS;
+	atomic_thread_fence(memory_order_release);
+	t->magic = GBD_TRACE_MAGIC;
+	return t;
+}
+
+/* unmaps and removes the buffer */
+static inline void gbd_trace_close(gbd_trace_t *t)
+{
+	char path[sizeof(GBD_TRACE_PREFIX) + 16];
+
+	if (!t)
+		return;
+	snprintf(path, sizeof(path), "/" GBD_TRACE_PREFIX "%d", (int)t->pid);
+	munmap(t, gbd_trace_bytes(t->nevents));
+	shm_unlink(path);
+}
+
+#endif /* __GBD_TRACE_H__ */
@@ -12,42 +12,231 @@
  * The program in this file is licensed under the terms of the MIT license.
  */
 
+/* sendmmsg(2) */
+#define _GNU_SOURCE
+
 /* alsa */
 #include <alsa/asoundlib.h>
 #include <alsa/pcm.h>
 #include <alsa/pcm_external.h>
 
+/* asynchronous sender */
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "gbd_ring.h"
+
+/* compact wire encodings */
+#include "gbd_codec.h"
+
+/* multichannel input */
+#include "gbd_mix.h"
+#define GBD_LFE_GAIN 0.70710678f
+
+/* edge feature extraction */
+#include "gbd_features.h"
+#define GBD_MODE_PCM 0
+#define GBD_MODE_FEATURES 1
+#define GBD_FEATURE_BANDS 24
+#define GBD_FEATURE_HOP 5	/* ms */
+
+/* async mode defaults (ms) */
+#define GBD_ASYNC_LATENCY 10
+#define GBD_ASYNC_BUFFER 500
+#define GBD_ASYNC_IOV_MAX 64
+
+/* backlog (ms) past which periods are shed, see gbd_tcp_behind() */
+#define GBD_SHED_LATENCY 250
+
+/* datagrams per sendmmsg(2) */
+#define GBD_UDP_VLEN 64
+
+/* shared memory transport */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "gbd_shm.h"
+
+/* local metrics endpoint */
+#include "gbd_metrics.h"
+
+/* latency tracing */
+#include "gbd_trace.h"
+
+/* connection state and reconnect backoff (ms) */
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#define GBD_LINK_DOWN 0
+#define GBD_LINK_UP 1
+#define GBD_RECONNECT_MIN 250
+#define GBD_RECONNECT_MAX 8000
+#define GBD_LINK_POLL 500
+#define GBD_IO_TIMEOUT 1000
+#define GBD_WARN_INTERVAL 10	/* s */
+#define GBD_DELAY_INTERVAL 500	/* ms between output latency samples */
+
+/* optional offers of the v1 handshake, and the v2 handshake itself,
+ * see gbd_offer_reply() */
+#define GBD_OFFER_ENCODING 0x1
+#define GBD_OFFER_TRANSPORT 0x2
+#define GBD_OFFER_HELLO 0x4
+#define GBD_OFFER_TIMEOUT 500	/* ms */
+#define GBD_HELLO_REPLY_MAX 4096	/* bytes, later versions included */
+#define GBD_PEERS_MAX 8
+
+/* a run of interleaved float frames on its way to the gbdserver */
+typedef struct __gbd_span {
+	int64_t tstamp;		/* capture time, CLOCK_MONOTONIC ns */
+	size_t frames;
+	const float *pcm;
+} gbd_span_t;
+
+/* per-thread encoding scratch */
+typedef struct __gbd_encoder {
+	uint8_t *buf;		/* encoded wire message(s) */
+	size_t size;
+	int16_t *pcm;		/* s16 staging */
+	size_t frames;
+} gbd_encoder_t;
+
 /* external pcm filter plugin object */
 typedef struct snd_pcm_gbdclient {
 	snd_pcm_extplug_t ext;
 	int fd;
 	int channels;
+
+	/* analysis stream: 5.1/7.1 (or mono) input is downmixed to
+	 * achannels by the sending thread, playback keeps all channels */
+	int achannels;
+	int mixing;
+	int lfe_forward;	/* the last analysis channel is the LFE */
+	gbd_mix_t mixer;
+
+	/* link: the gbdserver connection and everything negotiated on it
+	 * belong to the holder of link_lock. The alsa thread only ever
+	 * trylocks it; the link thread reconnects in the background. */
+	pthread_mutex_t link_lock;
+	int proto;			/* protocol version spoken */
+	atomic_int link;
+	atomic_int link_running;
+	pthread_t linker;
+	sem_t link_wakeup;
+	unsigned int rate;		/* stream parameters, for handshakes */
+	snd_pcm_uframes_t buffer_frames;
+	int sndbuf;			/* usable socket send buffer */
+	atomic_int out_delay;		/* slave delay (us), by gbdclient_transfer() */
+	int64_t delay_at;		/* ns, when out_delay was sampled */
+	int delay_sent;			/* last GBD_OUTPUT_DELAY sent */
+	int delay_ok;			/* gbdserver takes GBD_OUTPUT_DELAY */
+	int tstamps;			/* tcp audio with gbd_dgram_t headers */
+	unsigned long reconnects;
+	atomic_ulong periods_offline;	/* dropped while the link was down */
+	atomic_ulong periods_busy;	/* dropped, socket would block */
+	long shed_latency;		/* ms of backlog, 0: never shed */
+	int shedding;			/* by the sending thread */
+	atomic_ulong periods_shed;	/* dropped, gbdserver behind */
+	atomic_ulong shed_events;
+	time_t warn_time;
+	unsigned long warn_suppressed;
+
+	/* stream format: the audio is passed through untouched, only
+	 * the analysis copy is made interleaved float, by the sending
+	 * thread */
+	snd_pcm_format_t format;
+	unsigned int width;		/* bytes per sample */
+	uint8_t *raw;			/* interleaving (sync mode) */
+	float *pcm;			/* analysis copy (sync mode) */
+	float *tmp;			/* conversion ahead of downmix */
+	float *sender_pcm;		/* analysis copy (async mode) */
+	float *sender_tmp;
+
+	/* async mode: the alsa thread only queues periods in the
+	 * ring, the sender thread drains it to the gbdserver */
+	int async;
+	long async_latency;
+	long async_buffer;
+	gbd_ring_t *ring;
+	unsigned int ring_rate;
+	pthread_t sender;
+	sem_t wakeup;
+	atomic_int running;
+
+	/* async mode counters */
+	atomic_ulong periods_queued;
+	atomic_ulong periods_dropped;
+	atomic_ulong batches_sent;
+	atomic_uint ring_fill_max;
+
+	/* wire encoding: configured and negotiated with the gbdserver */
+	int encoding;
+	int wire;
+	gbd_encoder_t enc;		/* alsa thread (sync mode) */
+	gbd_encoder_t sender_enc;	/* sender thread (async mode) */
+
+	/* udp transport: audio datagrams beside the tcp control
+	 * connection */
+	int transport;
+	char stream[GBD_STREAM_NAME_MAX];	/* beat count segment */
+	const char *ipaddr;
+	const char *port;
+	int udp_fd;
+	int32_t session;
+	uint32_t seq;
+	atomic_ulong dgrams_sent;
+	atomic_ulong dgrams_dropped;
+
+	/* shm transport: the alsa thread commits periods straight into
+	 * a ring mapped by the local gbdserver */
+	gbd_shm_t *shm;
+	size_t shm_bytes;
+	char shm_name[GBD_SHM_NAME_MAX];
+	unsigned long shm_periods;
+
+	/* features mode: band energies are computed here (on the
+	 * sending thread) and sent instead of the pcm */
+	int mode;
+	long feature_bands;
+	long feature_hop;
+	long feature_window;	/* frames, 0 for the default */
+	int feature_engine;	/* GBD_FEATURE_* */
+	gbd_band_cfg_t band_list[GBD_FEATURE_BANDS_MAX];
+	unsigned int band_list_len;	/* 0: feature_bands log spaced */
+	int feat_table;		/* gbdserver took the band list */
+	int features;
+	int feat_tstamps;	/* vectors with gbd_dgram_t headers */
+	gbd_features_t feat;
+	float *feat_out;
+	size_t feat_max;	/* vectors feat_out holds */
+	unsigned long feat_vectors;
+
+	/* traffic; updated by the sending thread, see gbd_count_bytes() */
+	atomic_ullong bytes_raw;
+	atomic_ullong bytes_sent;
+	struct timespec t_start;
+
+	/* metrics endpoint; the histograms are fed by the sending
+	 * thread, the endpoint thread only reads */
+	gbd_metrics_t metrics;
+	atomic_ulong periods_sent;
+	atomic_int backlog;		/* tcp bytes queued, last seen */
+	gbd_hist_t period_frames;
+	gbd_hist_t send_us;
+
+	/* capture and send of every message, for gbd-trace */
+	gbd_trace_t *trace;
 } snd_pcm_gbdclient_t;
 
 /* internet sockets */
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
 /* GBD command passing */
-#define GBD_ERROR -1
-#define GBD_SUCCESS 0
-#define GBD_LADSPA_LIB_INIT 1
-#define GBD_CLIENT_CHANNELS 2
-#define GBD_AUDIO_SAMPLE_RATE 3
-#define GBD_PCM_PLUGIN_INIT 4
-#define GBD_BEAT_DETECTION_FUNC 5
-#define GBD_PCM_PLUGIN_CLOSE 6
-typedef struct __gbd_msg {
-	/* note: declare strict types to avoid 
-	 *       problems when executing on
-	 *       a 64-bit gbdclient host OS ...
-	 *       recall that the gbdserver on
-	 *       the raspberry pi is 32-bit */
-	int32_t cmd;
-	int32_t data;
-} gbd_msg_t;
+#include "gbd_proto.h"
 
 static ssize_t gbd_read(int fd, void *buf, size_t n)
 {
@@ -80,7 +269,7 @@ static ssize_t gbd_write(int fd, const void *buf, size_t n)
 
     pbuf = buf;
     for (count = 0; count < n; ) {
-        ret = write(fd, pbuf, n - count);
+        ret = send(fd, pbuf, n - count, MSG_NOSIGNAL);
         if (ret <= 0) {
             if (ret == -1 && errno == EINTR)
                 continue;
@@ -93,13 +282,66 @@ static ssize_t gbd_write(int fd, const void *buf, size_t n)
     return count;
 }
 
+static ssize_t gbd_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    struct msghdr mh;
+    ssize_t ret;
+    size_t count = 0;
+
+    memset(&mh, 0, sizeof(struct msghdr));
+    while (iovcnt > 0) {
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt;
+        ret = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            if (ret == -1 && errno == EINTR)
+                continue;
+            else
+                return -1;
+        }
+        count += ret;
+        /* skip what went out, resume a partially written iovec */
+        while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return count;
+}
+
 static int gbd_connect(const char *ipaddr, 
 		const char *port, int type)
 {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
+    struct sockaddr_un addr;
     int sfd, s;
 
+    /* a gbdserver on this host, listening on a unix socket */
+    if (ipaddr[0] == '/') {
+        if (strlen(ipaddr) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memset(&addr, 0, sizeof(struct sockaddr_un));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, ipaddr);
+        sfd = socket(AF_UNIX, type, 0);
+        if (sfd == -1)
+            return -1;
+        if (connect(sfd, (struct sockaddr *)&addr,
+                    sizeof(struct sockaddr_un)) == -1) {
+            close(sfd);
+            return -1;
+        }
+        return sfd;
+    }
+
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_canonname = NULL;
     hints.ai_addr = NULL;
@@ -125,233 +367,2557 @@ static int gbd_connect(const char *ipaddr,
     return (rp == NULL) ? -1 : sfd;
 }
 
-/*
- * func: gbdclient_transfer
- * desc: this function is invoked by the alsa-lib runtime and
- *       receives the alsa period pcm signal in alsa float format;
- *       it is responsible for sending the signal to the gbdserver
- *       for analysis as well as for passing the signal to the 
- *       configured alsa pcm slave.
- *
- *       plugin writers wishing to port this pcm plugin to a standalone
- *       audio application platform or some other operating system's 
- *       sound framework should consult the documentation on the 
- *       GBD github wiki for more details.
- */
-static snd_pcm_sframes_t gbdclient_transfer(snd_pcm_extplug_t * ext,
-				     const snd_pcm_channel_area_t * dst_areas,
-				     snd_pcm_uframes_t dst_offset,
-				     const snd_pcm_channel_area_t * src_areas,
-				     snd_pcm_uframes_t src_offset,
-				     snd_pcm_uframes_t size)
+static int gbd_encoder_alloc(gbd_encoder_t *enc, size_t frames,
+			     unsigned int channels)
 {
-	snd_pcm_gbdclient_t *gbd = (snd_pcm_gbdclient_t *) ext;
-	float *src, *dst;
-	gbd_msg_t msg;
-	size_t nbytes = size * gbd->channels * sizeof(float);
-
-	src = (float *)(src_areas->addr +
-			(src_areas->first + src_areas->step * src_offset) / 8);
-	
-	dst = (float *)(dst_areas->addr +
-			(dst_areas->first + dst_areas->step * dst_offset) / 8);
-
-	/* notify gbdserver of incoming audio signal for analysis */
-	msg.cmd = GBD_BEAT_DETECTION_FUNC;
-	msg.data = (int32_t)size;
-	if (gbd_write(gbd->fd, &msg, sizeof(msg)) < 0) {
-		fprintf(stderr, 
-				"%s:%s:%d:: WARNING!! GBD PCM cmd write failed!\n",
-				__FILE__, __func__, __LINE__);
-	}
+	size_t pcm = frames * channels * sizeof(float);
 
-	/* send audio signal to gbdserver for analysis */
-	if (gbd_write(gbd->fd, src, nbytes) < 0) {
-		fprintf(stderr, 
-				"%s:%s:%d:: WARNING!! GBD PCM data write failed!\n",
-				__FILE__, __func__, __LINE__);
-	};
+	free(enc->buf);
+	free(enc->pcm);
+	enc->frames = frames;
+	enc->size = sizeof(gbd_dgram_t) + sizeof(int32_t) +
+	    (pcm > gbd_rice_bound(frames, channels) ?
+	     pcm : gbd_rice_bound(frames, channels));
+	/* room for a full sendmmsg(2) vector of datagrams */
+	if (enc->size < GBD_UDP_VLEN * GBD_DGRAM_MAX)
+		enc->size = GBD_UDP_VLEN * GBD_DGRAM_MAX;
+	enc->buf = malloc(enc->size);
+	enc->pcm = malloc(frames * channels * sizeof(int16_t));
+	if (!enc->buf || !enc->pcm)
+		return -ENOMEM;
+	return 0;
+}
 
-	/* pass audio signal to alsa pcm slave */
-	memcpy(dst, src, nbytes);
-	return size;
+static void gbd_encoder_free(gbd_encoder_t *enc)
+{
+	free(enc->buf);
+	free(enc->pcm);
+	memset(enc, 0, sizeof(*enc));
 }
 
-static int gbdclient_close(snd_pcm_extplug_t * ext)
+/* traffic sent, against the float bytes it stands for; also read by
+ * the dump and the metrics endpoint */
+static inline void gbd_count_bytes(snd_pcm_gbdclient_t *gbd, size_t raw,
+				   size_t sent)
 {
-	snd_pcm_gbdclient_t *gbd = ext->private_data;
-	gbd_msg_t msg;
-	msg.cmd = GBD_PCM_PLUGIN_CLOSE;
-	if (gbd_write(gbd->fd, &msg, sizeof(msg)) < 0) {
-		SNDERR("WARNING: gbd server-side PCM plugin release failed!");
-	}
-	close(gbd->fd); 
-	free(gbd);
-	return 0;
+	if (raw)
+		atomic_fetch_add_explicit(&gbd->bytes_raw, raw,
+					  memory_order_relaxed);
+	atomic_fetch_add_explicit(&gbd->bytes_sent, sent, memory_order_relaxed);
 }
 
-static int gbdclient_init(snd_pcm_extplug_t * ext)
+/* worst case wire size of a period, header included */
+static size_t gbd_encode_bound(snd_pcm_gbdclient_t *gbd, size_t frames)
 {
-	snd_pcm_gbdclient_t *gbd = (snd_pcm_gbdclient_t *) ext;
-	int srate = ext->rate;
-	int err;
-	gbd_msg_t msg;
+	size_t rice = gbd_rice_bound(frames, gbd->achannels);
+	size_t pcm = frames * gbd->achannels * sizeof(float);
 
-	/* prepare to initialize gbdserver-side pcm plugin */
-	msg.cmd = GBD_CLIENT_CHANNELS;
-	msg.data = gbd->channels;
-	err = gbd_write(gbd->fd, &msg, sizeof(msg));
-	if (err < 0) {
-		SNDERR("gbd_write failed! (channels)");
-		return -EINVAL;
-	}
+	return sizeof(gbd_dgram_t) + sizeof(int32_t) +
+	    (rice > pcm ? rice : pcm);
+}
 
- 	msg.cmd = GBD_AUDIO_SAMPLE_RATE;
-	msg.data = srate;
-	err = gbd_write(gbd->fd, &msg, sizeof(msg));
-	if (err < 0) {
-		SNDERR("gbd_write failed! (sampel rate)");
-		return -EINVAL;
+/* most frames a datagram can carry in the negotiated encoding */
+static size_t gbd_dgram_frames(snd_pcm_gbdclient_t *gbd)
+{
+	size_t max = GBD_DGRAM_MAX - sizeof(gbd_dgram_t);
+
+	switch (gbd->wire) {
+	case GBD_ENCODING_S16:
+		return max / (gbd->achannels * sizeof(int16_t));
+	case GBD_ENCODING_RICE:
+		return ((max - sizeof(int32_t)) * 8 - 20 * gbd->achannels) /
+		    (25 * gbd->achannels);
+	default:
+		return max / (gbd->achannels * sizeof(float));
 	}
+}
 
-	/* initialize gbd server-side pcm plugin */
-	msg.cmd = GBD_PCM_PLUGIN_INIT;
-	err = gbd_write(gbd->fd, &msg, sizeof(msg));
-	if (err < 0) {
-		SNDERR("gbd_write failed! (plugin init)");
-		return -EINVAL;
+/*
+ * func: gbd_encode
+ * desc: encodes the period in the negotiated wire encoding as the
+ *       payload at dst + hdrlen and fills in the matching gbd_msg_t;
+ *       returns the size of the message, header included. dst need
+ *       not be aligned since messages are packed back to back.
+ */
+static size_t gbd_encode(snd_pcm_gbdclient_t *gbd, gbd_encoder_t *enc,
+			 uint8_t *dst, size_t hdrlen, const float *src,
+			 size_t frames, gbd_msg_t *msg)
+{
+	size_t n = frames * gbd->achannels;
+	int32_t nframes = (int32_t)frames;
+	size_t len;
+
+	switch (gbd->wire) {
+	case GBD_ENCODING_RICE:
+		gbd_f32_to_s16(enc->pcm, src, n);
+		memcpy(dst + hdrlen, &nframes, sizeof(nframes));
+		len = sizeof(nframes) +
+		    gbd_rice_encode(dst + hdrlen + sizeof(nframes),
+				    enc->pcm, frames, gbd->achannels);
+		msg->cmd = GBD_BEAT_DETECTION_PACKED;
+		msg->data = (int32_t)len;
+		break;
+	case GBD_ENCODING_S16:
+		gbd_f32_to_s16(enc->pcm, src, n);
+		len = n * sizeof(int16_t);
+		memcpy(dst + hdrlen, enc->pcm, len);
+		msg->cmd = GBD_BEAT_DETECTION_FUNC;
+		msg->data = nframes;
+		break;
+	default:
+		len = n * sizeof(float);
+		memcpy(dst + hdrlen, src, len);
+		msg->cmd = GBD_BEAT_DETECTION_FUNC;
+		msg->data = nframes;
+		break;
 	}
 
-	err = gbd_read(gbd->fd, &msg, sizeof(msg));
-	if (err < 0 || msg.cmd == GBD_ERROR) {
-		SNDERR("Failed to initialize gbdserver-side PCM plugin module");
-		return -EINVAL;
-	}	
+	gbd_count_bytes(gbd, sizeof(gbd_msg_t) + n * sizeof(float), hdrlen + len);
+	return hdrlen + len;
+}
 
-	return 0;
+static void gbd_udp_flush(snd_pcm_gbdclient_t *gbd, struct mmsghdr *mm,
+			  int n)
+{
+	int ret;
+
+	if (n == 0)
+		return;
+	ret = sendmmsg(gbd->udp_fd, mm, n, MSG_DONTWAIT);
+	if (ret < n)
+		atomic_fetch_add_explicit(&gbd->dgrams_dropped,
+					  ret < 0 ? n : n - ret,
+					  memory_order_relaxed);
+	if (ret > 0)
+		atomic_fetch_add_explicit(&gbd->dgrams_sent, ret,
+					  memory_order_relaxed);
 }
 
-static snd_pcm_extplug_callback_t pcm_gbdclient_callback = {
-	.transfer = gbdclient_transfer,
-	.init = gbdclient_init,
-	.close = gbdclient_close,
-};
+/* seq of the next message, traced as captured at tstamp */
+static uint32_t gbd_next_seq(snd_pcm_gbdclient_t *gbd, int64_t tstamp)
+{
+	gbd_trace(gbd->trace, GBD_TRACE_CAPTURE, gbd->seq, tstamp);
+	return gbd->seq++;
+}
 
-SND_PCM_PLUGIN_DEFINE_FUNC(gbdclient)
+/*
+ * func: gbd_udp_send
+ * desc: sends the spans as datagrams of at most GBD_DGRAM_MAX bytes,
+ *       a full vector of them per sendmmsg(2). The socket never
+ *       blocks; a datagram it cannot take right away is dropped just
+ *       like one lost in transit, and the gbdserver conceals the gap.
+ */
+static void gbd_udp_send(snd_pcm_gbdclient_t *gbd, gbd_encoder_t *enc,
+			 const gbd_span_t *span, int nspans)
 {
-	snd_config_iterator_t i, next;
-	snd_pcm_gbdclient_t *gbd;
-	snd_config_t *sconf = NULL;
-	const char *ipaddr;
-	const char *port;
-	long channels = 2;
-	int err;
+	struct mmsghdr mm[GBD_UDP_VLEN];
+	struct iovec iov[GBD_UDP_VLEN];
+	size_t max = gbd_dgram_frames(gbd);
+	size_t off, chunk, pos = 0;
+	gbd_dgram_t dgram;
 	gbd_msg_t msg;
+	int i, n = 0;
 
-	/* Parse config file (e.g. .asoundrc) options */
-	snd_config_for_each(i, next, conf) {
-		snd_config_t *n = snd_config_iterator_entry(i);
-		const char *id;
-		if (snd_config_get_id(n, &id) < 0)
-			continue;
-
-		if (strcmp(id, "comment") == 0 || strcmp(id, "type") == 0
-		    || strcmp(id, "hint") == 0)
-			continue;
-
-		if (strcmp(id, "slave") == 0) {
-			sconf = n;
-			continue;
+	memset(mm, 0, sizeof(mm));
+	for (i = 0; i < nspans; i++) {
+		for (off = 0; off < span[i].frames; off += chunk) {
+			chunk = span[i].frames - off;
+			if (chunk > max)
+				chunk = max;
+			if (n == GBD_UDP_VLEN || pos + GBD_DGRAM_MAX > enc->size) {
+				gbd_udp_flush(gbd, mm, n);
+				n = 0;
+				pos = 0;
+			}
+			iov[n].iov_base = enc->buf + pos;
+			iov[n].iov_len = gbd_encode(gbd, enc, enc->buf + pos,
+						    sizeof(dgram),
+						    span[i].pcm + off * gbd->achannels,
+						    chunk, &msg);
+			dgram.cmd = msg.cmd;
+			dgram.data = msg.data;
+			dgram.session = gbd->session;
+			dgram.tstamp = span[i].tstamp +
+			    (int64_t)off * 1000000000 / gbd->ext.rate;
+			dgram.seq = gbd_next_seq(gbd, dgram.tstamp);
+			memcpy(enc->buf + pos, &dgram, sizeof(dgram));
+			mm[n].msg_hdr.msg_iov = &iov[n];
+			mm[n].msg_hdr.msg_iovlen = 1;
+			pos += iov[n].iov_len;
+			n++;
 		}
+	}
+	gbd_udp_flush(gbd, mm, n);
+}
 
-		if (strcmp(id, "ipaddr") == 0) {
-			snd_config_get_string(n, &ipaddr);
-			continue;
-		}
+/* tstamp: capture time of the frame completing the first vector */
+static int gbd_send_vectors(snd_pcm_gbdclient_t *gbd, size_t nvec,
+			    int64_t tstamp)
+{
+	struct iovec iov[2];
+	gbd_dgram_t hdr;
 
-		if (strcmp(id, "port") == 0) {
-			snd_config_get_string(n, &port);
-			continue;
-		}
+	if (nvec == 0)
+		return 0;
+	hdr.cmd = GBD_BEAT_FEATURES;
+	hdr.data = (int32_t)nvec;
+	hdr.session = gbd->session;
+	hdr.seq = gbd_next_seq(gbd, tstamp);
+	hdr.tstamp = tstamp;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = gbd->feat_tstamps ? sizeof(gbd_dgram_t) :
+	    sizeof(gbd_msg_t);
+	iov[1].iov_base = gbd->feat_out;
+	iov[1].iov_len = nvec * gbd->feat.bands * sizeof(float);
+	gbd_count_bytes(gbd, 0, iov[0].iov_len + iov[1].iov_len);
+	gbd->feat_vectors += nvec;
+	return gbd_writev(gbd->fd, iov, 2) < 0 ? -1 : 0;
+}
 
-		if (strcmp(id, "channels") == 0) {
-			snd_config_get_integer(n, &channels);
-			if (channels != 2) {
-				SNDERR("Only stereo streams supported");
-				return -EINVAL;
+/*
+ * func: gbd_send_features
+ * desc: features mode counterpart of gbd_send(); runs the spans
+ *       through the band energy extractor and sends the completed
+ *       feature vectors in one GBD_BEAT_FEATURES message, stamped
+ *       with the capture time of the first one to the frame.
+ */
+static int gbd_send_features(snd_pcm_gbdclient_t *gbd,
+			     const gbd_span_t *span, int nspans)
+{
+	gbd_features_t *f = &gbd->feat;
+	size_t off, chunk, nvec = 0;
+	int64_t tstamp = 0;
+	int i;
+
+	for (i = 0; i < nspans; i++) {
+		gbd_count_bytes(gbd, sizeof(gbd_msg_t) +
+				span[i].frames * gbd->achannels * sizeof(float), 0);
+		for (off = 0; off < span[i].frames; off += chunk) {
+			if (nvec == gbd->feat_max) {
+				if (gbd_send_vectors(gbd, nvec, tstamp) < 0)
+					return -1;
+				nvec = 0;
 			}
-			continue;
+			/* no more frames than complete vectors fit */
+			chunk = (gbd->feat_max - nvec) * f->hop - f->pending;
+			if (chunk > span[i].frames - off)
+				chunk = span[i].frames - off;
+			if (nvec == 0)
+				tstamp = span[i].tstamp + (int64_t)(off + f->hop -
+				    f->pending - 1) * 1000000000 / gbd->ext.rate;
+			nvec += gbd_features_process(f, span[i].pcm +
+						     off * gbd->achannels, chunk,
+						     gbd->feat_out + nvec * f->bands);
 		}
-		SNDERR("Unknown field %s", id);
-		return -EINVAL;
 	}
+	return gbd_send_vectors(gbd, nvec, tstamp);
+}
 
-	/* Make sure an ip address was specified */
-	if (!ipaddr || !port) {
-		SNDERR("Missing \"ipaddr\" or \"port\"\n");
-		return -EINVAL;
+/* start of the frames at offset if the areas are interleaved, else NULL */
+static const void *gbd_interleaved(snd_pcm_gbdclient_t *gbd,
+				   const snd_pcm_channel_area_t *areas,
+				   snd_pcm_uframes_t offset)
+{
+	unsigned int bits = gbd->width * 8;
+	int c;
+
+	for (c = 0; c < gbd->channels; c++)
+		if (areas[c].addr != areas[0].addr ||
+		    areas[c].first != areas[0].first + c * bits ||
+		    areas[c].step != gbd->channels * bits)
+			return NULL;
+	return (const uint8_t *)areas[0].addr +
+	    (areas[0].first + areas[0].step * offset) / 8;
+}
+
+/* copies frames to dst interleaved, still in the stream format */
+static void gbd_interleave(snd_pcm_gbdclient_t *gbd, void *dst,
+			   const snd_pcm_channel_area_t *areas,
+			   snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
+{
+	const void *src = gbd_interleaved(gbd, areas, offset);
+	snd_pcm_channel_area_t area;
+	int c;
+
+	if (src) {
+		memcpy(dst, src, frames * gbd->channels * gbd->width);
+		return;
+	}
+	for (c = 0; c < gbd->channels; c++) {
+		area.addr = dst;
+		area.first = c * gbd->width * 8;
+		area.step = gbd->channels * gbd->width * 8;
+		snd_pcm_area_copy(&area, 0, &areas[c], offset, frames,
+				  gbd->format);
 	}
+}
 
-	/* Make sure an ALSA slave PCM device was specified */
-	if (!sconf) {
-		SNDERR("Must include slave configuration with gbdclient plugin");
-		return -EINVAL;
+/* n interleaved samples in the stream format to float */
+static void gbd_to_float(snd_pcm_gbdclient_t *gbd, float *dst,
+			 const void *src, size_t n)
+{
+	switch (gbd->format) {
+	case SND_PCM_FORMAT_S16:
+		gbd_s16_to_f32(dst, src, n);
+		break;
+	case SND_PCM_FORMAT_S32:
+		gbd_s32_to_f32(dst, src, n);
+		break;
+	default:
+		memcpy(dst, src, n * sizeof(float));
+		break;
 	}
+}
 
-	/* Alloc local GBD object */
-	gbd = calloc(1, sizeof(*gbd));
-	if (gbd == NULL)
-		return -ENOMEM;
+/*
+ * func: gbd_analysis
+ * desc: turns interleaved frames in the stream format into the
+ *       analysis stream, converted to float and downmixed as
+ *       configured, in dst; tmp holds the float copy ahead of the
+ *       downmix. Float periods without downmix need no copy at all.
+ */
+static const float *gbd_analysis(snd_pcm_gbdclient_t *gbd, float *dst,
+				 float *tmp, const void *src, size_t frames)
+{
+	const float *pcm = src;
 
-	/* Initialize local GDB object members */
-	gbd->ext.version = SND_PCM_EXTPLUG_VERSION;
-	gbd->ext.name = "gbdclient";
-	gbd->ext.callback = &pcm_gbdclient_callback;
-	gbd->ext.private_data = gbd;
-	gbd->channels = channels;
-	gbd->fd = gbd_connect(ipaddr, port, SOCK_STREAM);
-	if (gbd->fd < 0) {
-		SNDERR("Failed to connect with gbdserver");
-		return -EINVAL;
+	if (!gbd->mixing && gbd->format == SND_PCM_FORMAT_FLOAT)
+		return src;
+	if (gbd->format != SND_PCM_FORMAT_FLOAT) {
+		pcm = gbd->mixing ? tmp : dst;
+		gbd_to_float(gbd, (float *)pcm, src, frames * gbd->channels);
 	}
+	if (gbd->mixing)
+		gbd_mix_apply(&gbd->mixer, dst, pcm, frames);
+	return dst;
+}
 
-	/* Load gbd server-side DSP LADSPA library module */
-	msg.cmd = GBD_LADSPA_LIB_INIT;
-	err = gbd_write(gbd->fd, &msg, sizeof(msg));
-	if (err < 0) {
-		SNDERR("Failed to initialize gbd LADSPA module");
-		return -EINVAL;
-	}
+/* sync mode analysis copy */
+static const float *gbd_analysis_frames(snd_pcm_gbdclient_t *gbd,
+					const snd_pcm_channel_area_t *areas,
+					snd_pcm_uframes_t offset,
+					snd_pcm_uframes_t frames)
+{
+	const void *src = gbd_interleaved(gbd, areas, offset);
 
-	err = gbd_read(gbd->fd, &msg, sizeof(msg));
-	if (err < 0 || msg.cmd == GBD_ERROR) {
-		SNDERR("Failed to initialize gbd LADSPA module");
-		return -EINVAL;
+	if (!src) {
+		gbd_interleave(gbd, gbd->raw, areas, offset, frames);
+		src = gbd->raw;
 	}
+	return gbd_analysis(gbd, gbd->pcm, gbd->tmp, src, frames);
+}
 
-	/* Create gbdclient external PCM filter plugin */
-	err = snd_pcm_extplug_create(&gbd->ext, name, root, sconf, stream, mode);
-	if (err < 0) {
-		close(gbd->fd);
-		free(gbd);
+/* takes the link down; called with link_lock held, also on the alsa
+ * thread, so the link thread warns about it */
+static void gbd_link_lost(snd_pcm_gbdclient_t *gbd)
+{
+	atomic_store(&gbd->link, GBD_LINK_DOWN);
+}
+
+static void gbd_link_stop(snd_pcm_gbdclient_t *gbd)
+{
+	if (!atomic_load(&gbd->link_running))
+		return;
+	atomic_store(&gbd->link_running, 0);
+	sem_post(&gbd->link_wakeup);
+	pthread_join(gbd->linker, NULL);
+}
+
+/* ring size for async_buffer ms of audio, plus headroom for the
+ * per-period record headers */
+static uint32_t gbd_ring_size(snd_pcm_gbdclient_t *gbd, unsigned int rate,
+			      int channels)
+{
+	uint64_t need;
+	uint32_t size;
+
+	need = (uint64_t)rate * channels * sizeof(float) *
+	    gbd->async_buffer / 1000;
+	need += need / 4;
+	for (size = 65536; size < need && size < (1u << 30); size <<= 1)
+		;
+	return size;
+}
+
+/* copies a period into the ring; -1 when it is full */
+static int gbd_period_put(gbd_ring_t *ring, const float *src,
+			  snd_pcm_uframes_t frames, int channels,
+			  int64_t tstamp, uint32_t seq)
+{
+	size_t nbytes = frames * channels * sizeof(float);
+	uint32_t len = sizeof(gbd_period_t) + nbytes;
+	gbd_period_t *per;
+
+	per = gbd_ring_reserve(ring, len);
+	if (!per)
+		return -1;
+	per->tstamp = tstamp;
+	per->frames = frames;
+	per->seq = seq;
+	memcpy(per->pcm, src, nbytes);
+	gbd_ring_commit(ring, len);
+	return 0;
+}
+
+/*
+ * func: gbd_shm_open
+ * desc: creates and maps the shared memory ring offered to a local
+ *       gbdserver; it stays linked only until the gbdserver has
+ *       answered (see gbd_shm_negotiate()).
+ */
+static int gbd_shm_open(snd_pcm_gbdclient_t *gbd, unsigned int rate)
+{
+	static atomic_uint serial;
+	uint32_t size = gbd_ring_size(gbd, rate, gbd->achannels);
+	size_t bytes = gbd_shm_bytes(size);
+	gbd_shm_t *shm;
+	int fd, err;
+
+	snprintf(gbd->shm_name, sizeof(gbd->shm_name), "/gbd-%d-%u",
+		 (int)getpid(), atomic_fetch_add(&serial, 1));
+	fd = shm_open(gbd->shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		return -errno;
+	if (ftruncate(fd, bytes) < 0) {
+		err = -errno;
+		close(fd);
+		shm_unlink(gbd->shm_name);
+		return err;
+	}
+	shm = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = -errno;
+	close(fd);
+	if (shm == MAP_FAILED) {
+		shm_unlink(gbd->shm_name);
 		return err;
 	}
 
-	/* Set external PCM filter plugin constraints */
-	snd_pcm_extplug_set_param_minmax(&gbd->ext,
-					 SND_PCM_EXTPLUG_HW_CHANNELS,
-					 gbd->channels,
-					 gbd->channels);
-	snd_pcm_extplug_set_slave_param(&gbd->ext,
-					SND_PCM_EXTPLUG_HW_CHANNELS,
-					gbd->channels);
-	snd_pcm_extplug_set_param(&gbd->ext,
-				  SND_PCM_EXTPLUG_HW_FORMAT,
-				  SND_PCM_FORMAT_FLOAT);
-	snd_pcm_extplug_set_slave_param(&gbd->ext, SND_PCM_EXTPLUG_HW_FORMAT,
-					SND_PCM_FORMAT_FLOAT);
+	shm->magic = GBD_SHM_MAGIC;
+	shm->version = GBD_SHM_VERSION;
+	shm->channels = gbd->achannels;
+	shm->rate = rate;
+	atomic_init(&shm->wake, 0);
+	atomic_init(&shm->waiting, 0);
+	atomic_init(&shm->dropped, 0);
+	shm->reserved = 0;
+	gbd_ring_init(gbd_shm_ring(shm), size);
+
+	gbd->shm = shm;
+	gbd->shm_bytes = bytes;
+	gbd->shm_periods = 0;
+	return 0;
+}
+
+static void gbd_shm_close(snd_pcm_gbdclient_t *gbd)
+{
+	if (!gbd->shm)
+		return;
+	munmap(gbd->shm, gbd->shm_bytes);
+	gbd->shm = NULL;
+	gbd->shm_bytes = 0;
+}
+
+/*
+ * func: gbd_shm_queue
+ * desc: shm transport counterpart of gbd_send() in gbdclient_transfer();
+ *       the period is copied once, straight into the gbdserver's view,
+ *       and the gbdserver is only woken with a syscall when it sleeps.
+ *       When the ring is full, the period is dropped from analysis
+ *       (playback is unaffected).
+ */
+static void gbd_shm_queue(snd_pcm_gbdclient_t *gbd, const float *src,
+			  snd_pcm_uframes_t size, int64_t tstamp)
+{
+	if (gbd_period_put(gbd_shm_ring(gbd->shm), src, size, gbd->achannels,
+			   tstamp, gbd_next_seq(gbd, tstamp)) < 0) {
+		atomic_fetch_add(&gbd->shm->dropped, 1);
+		return;
+	}
+	gbd->shm_periods++;
+	gbd_shm_wake(gbd->shm);
+}
+
+/* latest output latency, if it changed since it was last sent */
+static int gbd_send_delay(snd_pcm_gbdclient_t *gbd)
+{
+	gbd_msg_t msg;
+
+	msg.data = atomic_load_explicit(&gbd->out_delay, memory_order_relaxed);
+	if (!gbd->delay_ok || msg.data == gbd->delay_sent)
+		return 0;
+	msg.cmd = GBD_OUTPUT_DELAY;
+	gbd->delay_sent = msg.data;
+	gbd_count_bytes(gbd, 0, sizeof(msg));
+	return gbd_write(gbd->fd, &msg, sizeof(msg)) < 0 ? -1 : 0;
+}
+
+/* bytes the tcp connection holds unsent or unacknowledged, or -1
+ * if the audio does not go that way */
+static int gbd_tcp_queued(snd_pcm_gbdclient_t *gbd)
+{
+	int queued;
+
+	if (gbd->shm || gbd->udp_fd >= 0)
+		return -1;
+	if (ioctl(gbd->fd, SIOCOUTQ, &queued) < 0)
+		return -1;
+	atomic_store_explicit(&gbd->backlog, queued, memory_order_relaxed);
+	return queued;
+}
+
+/* sync mode: whether the socket could not take another nbytes
+ * right now, i.e. sending would block the alsa thread */
+static int gbd_tcp_busy(snd_pcm_gbdclient_t *gbd, int queued, size_t nbytes)
+{
+	if (queued < 0 || gbd->sndbuf <= 0)
+		return 0;
+	return (size_t)queued + nbytes > (size_t)gbd->sndbuf;
+}
+
+/*
+ * func: gbd_tcp_behind
+ * desc: whether the gbdserver has fallen behind realtime, i.e. the
+ *       audio queued on the connection stands for more than
+ *       shed_latency ms; the caller then sheds its periods instead of
+ *       sending them, and they are counted here. Once behind, whole
+ *       periods are shed until the backlog is down to half of that,
+ *       so the analysis skips a stretch and catches up rather than
+ *       seeing every other period. The wire size of shed_latency ms
+ *       follows the encoding, from the traffic so far.
+ */
+static int gbd_tcp_behind(snd_pcm_gbdclient_t *gbd, int queued,
+			  unsigned int periods)
+{
+	uint64_t raw = atomic_load_explicit(&gbd->bytes_raw,
+					    memory_order_relaxed);
+	double limit;
+
+	if (queued < 0 || gbd->shed_latency <= 0 || !raw)
+		return 0;
+	limit = (double)gbd->shed_latency * gbd->ext.rate / 1000 *
+	    gbd->achannels * sizeof(float) *
+	    atomic_load_explicit(&gbd->bytes_sent, memory_order_relaxed) / raw;
+	if (gbd->shedding)
+		limit /= 2;
+	if (queued <= limit) {
+		gbd->shedding = 0;
+		return 0;
+	}
+	if (!gbd->shedding) {
+		gbd->shedding = 1;
+		atomic_fetch_add_explicit(&gbd->shed_events, 1,
+					  memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&gbd->periods_shed, periods,
+				  memory_order_relaxed);
+	return 1;
+}
+
+/*
+ * func: gbd_send
+ * desc: sends a run of periods to the gbdserver; float periods on TCP
+ *       go out with one writev(2) straight from the caller's buffers,
+ *       encoded ones are packed back to back into the encoder's
+ *       scratch buffer first. Called with link_lock held; returns -1
+ *       if the connection failed.
+ */
+static int gbd_send(snd_pcm_gbdclient_t *gbd, gbd_encoder_t *enc,
+		    const gbd_span_t *span, int nspans)
+{
+	struct iovec iov[2 * GBD_ASYNC_IOV_MAX];
+	gbd_dgram_t hdr[GBD_ASYNC_IOV_MAX];
+	size_t hdrlen = gbd->tstamps ? sizeof(gbd_dgram_t) : sizeof(gbd_msg_t);
+	size_t off, chunk, len, pos = 0;
+	gbd_dgram_t dgram;
+	gbd_msg_t msg;
+	int i;
+
+	/* output latency ahead of the audio it applies to */
+	if (gbd_send_delay(gbd) < 0)
+		return -1;
+
+	if (gbd->features)
+		return gbd_send_features(gbd, span, nspans);
+
+	if (gbd->shm) {
+		for (i = 0; i < nspans; i++)
+			gbd_shm_queue(gbd, span[i].pcm, span[i].frames,
+				      span[i].tstamp);
+		return 0;
+	}
+
+	if (gbd->udp_fd >= 0) {
+		gbd_udp_send(gbd, enc, span, nspans);
+		return 0;
+	}
+
+	if (gbd->wire == GBD_ENCODING_FLOAT) {
+		for (i = 0; i < nspans; i++) {
+			hdr[i].cmd = GBD_BEAT_DETECTION_FUNC;
+			hdr[i].data = (int32_t)span[i].frames;
+			hdr[i].session = gbd->session;
+			hdr[i].seq = gbd_next_seq(gbd, span[i].tstamp);
+			hdr[i].tstamp = span[i].tstamp;
+			iov[2 * i].iov_base = &hdr[i];
+			iov[2 * i].iov_len = hdrlen;
+			iov[2 * i + 1].iov_base = (void *)span[i].pcm;
+			iov[2 * i + 1].iov_len =
+			    span[i].frames * gbd->achannels * sizeof(float);
+			gbd_count_bytes(gbd, sizeof(gbd_msg_t) + iov[2 * i + 1].iov_len,
+					iov[2 * i].iov_len + iov[2 * i + 1].iov_len);
+		}
+		return gbd_writev(gbd->fd, iov, 2 * nspans) < 0 ? -1 : 0;
+	}
+
+	for (i = 0; i < nspans; i++) {
+		for (off = 0; off < span[i].frames; off += chunk) {
+			chunk = span[i].frames - off;
+			if (chunk > enc->frames)
+				chunk = enc->frames;
+			if (pos + gbd_encode_bound(gbd, chunk) > enc->size) {
+				if (gbd_write(gbd->fd, enc->buf, pos) < 0)
+					return -1;
+				pos = 0;
+			}
+			len = gbd_encode(gbd, enc, enc->buf + pos, hdrlen,
+					 span[i].pcm + off * gbd->achannels,
+					 chunk, &msg);
+			dgram.cmd = msg.cmd;
+			dgram.data = msg.data;
+			dgram.session = gbd->session;
+			dgram.tstamp = span[i].tstamp +
+			    (int64_t)off * 1000000000 / gbd->ext.rate;
+			dgram.seq = gbd_next_seq(gbd, dgram.tstamp);
+			memcpy(enc->buf + pos, &dgram, hdrlen);
+			pos += len;
+		}
+	}
+	return gbd_write(gbd->fd, enc->buf, pos) < 0 ? -1 : 0;
+}
+
+/* gbd_send(), counted and, with the metrics endpoint or tracing on,
+ * timed; the messages sent are traced as such */
+static int gbd_send_timed(snd_pcm_gbdclient_t *gbd, gbd_encoder_t *enc,
+			  const gbd_span_t *span, int nspans)
+{
+	int timed = gbd->metrics.fd >= 0 || gbd->trace;
+	int64_t t0 = timed ? gbd_trace_now() : 0, t1;
+	uint32_t seq = gbd->seq;
+	int ret;
+
+	ret = gbd_send(gbd, enc, span, nspans);
+	if (timed) {
+		t1 = gbd_trace_now();
+		gbd_hist_observe(&gbd->send_us, (t1 - t0) / 1000);
+		for (; ret == 0 && seq != gbd->seq; seq++)
+			gbd_trace(gbd->trace, GBD_TRACE_SEND, seq, t1);
+	}
+	if (ret == 0)
+		atomic_fetch_add_explicit(&gbd->periods_sent, nspans,
+					  memory_order_relaxed);
+	return ret;
+}
+
+/*
+ * func: gbd_sender_thread
+ * desc: async mode network sender; it sleeps until the alsa thread
+ *       queues a period, lets further periods accumulate for up to
+ *       the configured latency budget and then sends everything
+ *       queued in one go (see gbd_send()).
+ */
+static void *gbd_sender_thread(void *arg)
+{
+	snd_pcm_gbdclient_t *gbd = arg;
+	gbd_span_t span[GBD_ASYNC_IOV_MAX];
+	struct timespec budget;
+	gbd_period_t *per;
+	uint32_t pos, len;
+	size_t used;
+	int n;
+
+	budget.tv_sec = gbd->async_latency / 1000;
+	budget.tv_nsec = (gbd->async_latency % 1000) * 1000000L;
+
+	for (;;) {
+		while (sem_wait(&gbd->wakeup) < 0 && errno == EINTR)
+			;
+		if (atomic_load(&gbd->running) && gbd->async_latency > 0)
+			nanosleep(&budget, NULL);
+		while (sem_trywait(&gbd->wakeup) == 0)
+			;
+
+		/* drain */
+		pos = gbd_ring_read_pos(gbd->ring);
+		for (;;) {
+			for (n = 0, used = 0; n < GBD_ASYNC_IOV_MAX; n++) {
+				per = gbd_ring_next(gbd->ring, &pos, &len);
+				if (!per)
+					break;
+				span[n].tstamp = per->tstamp;
+				span[n].frames = per->frames;
+				/* the conversion and downmix kept off the
+				 * alsa thread */
+				span[n].pcm = gbd_analysis(gbd, gbd->sender_pcm + used,
+							   gbd->sender_tmp,
+							   per->pcm, per->frames);
+				if (span[n].pcm != (const float *)per->pcm)
+					used += per->frames * gbd->achannels;
+			}
+			if (n == 0)
+				break;
+			/* no link, or the gbdserver behind: the batch
+			 * is dropped unsent */
+			pthread_mutex_lock(&gbd->link_lock);
+			if (atomic_load(&gbd->link) != GBD_LINK_UP)
+				atomic_fetch_add_explicit(&gbd->periods_offline, n,
+							  memory_order_relaxed);
+			else if (gbd_tcp_behind(gbd, gbd_tcp_queued(gbd), n))
+				;
+			else if (gbd_send_timed(gbd, &gbd->sender_enc, span, n) < 0)
+				gbd_link_lost(gbd);
+			else
+				atomic_fetch_add_explicit(&gbd->batches_sent, 1,
+							  memory_order_relaxed);
+			pthread_mutex_unlock(&gbd->link_lock);
+			gbd_ring_release(gbd->ring, pos);
+		}
+
+		if (!atomic_load(&gbd->running))
+			break;
+	}
+	return NULL;
+}
+
+static int gbd_async_start(snd_pcm_gbdclient_t *gbd, unsigned int rate)
+{
+	uint32_t size, frames;
+
+	if (gbd->ring && gbd->ring_rate != rate) {
+		free(gbd->ring);
+		gbd->ring = NULL;
+	}
+	if (!gbd->ring) {
+		size = gbd_ring_size(gbd, rate, gbd->channels);
+		gbd->ring = malloc(gbd_ring_bytes(size));
+		if (!gbd->ring)
+			return -ENOMEM;
+		gbd_ring_init(gbd->ring, size);
+		gbd->ring_rate = rate;
+	}
+
+	/* room for as many analysis frames as the ring can queue, and
+	 * for one period converted ahead of the downmix */
+	free(gbd->sender_pcm);
+	free(gbd->sender_tmp);
+	gbd->sender_pcm = NULL;
+	gbd->sender_tmp = NULL;
+	if (gbd->format != SND_PCM_FORMAT_FLOAT || gbd->mixing) {
+		frames = gbd->ring->size / (gbd->width * gbd->channels);
+		gbd->sender_pcm = malloc(frames * gbd->achannels *
+					 sizeof(float));
+		if (!gbd->sender_pcm)
+			return -ENOMEM;
+	}
+	if (gbd->format != SND_PCM_FORMAT_FLOAT && gbd->mixing) {
+		gbd->sender_tmp = malloc(gbd->buffer_frames * gbd->channels *
+					 sizeof(float));
+		if (!gbd->sender_tmp)
+			return -ENOMEM;
+	}
+
+	atomic_store(&gbd->running, 1);
+	if (pthread_create(&gbd->sender, NULL, gbd_sender_thread, gbd)) {
+		atomic_store(&gbd->running, 0);
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+/* flushes whatever is still queued and joins the sender */
+static void gbd_async_stop(snd_pcm_gbdclient_t *gbd)
+{
+	if (!atomic_load(&gbd->running))
+		return;
+	atomic_store(&gbd->running, 0);
+	sem_post(&gbd->wakeup);
+	pthread_join(gbd->sender, NULL);
+}
+
+/*
+ * func: gbd_async_queue
+ * desc: async mode counterpart of gbd_send() in gbdclient_transfer();
+ *       copies the period into the ring, interleaved but still in the
+ *       stream format, and returns without blocking.
+ *       When the ring is full, the period is dropped from analysis
+ *       (playback is unaffected).
+ */
+static void gbd_async_queue(snd_pcm_gbdclient_t *gbd,
+			    const snd_pcm_channel_area_t *areas,
+			    snd_pcm_uframes_t offset, snd_pcm_uframes_t size,
+			    int64_t tstamp)
+{
+	uint32_t len = sizeof(gbd_period_t) + size * gbd->channels * gbd->width;
+	unsigned int fill, max;
+	gbd_period_t *per;
+
+	per = gbd_ring_reserve(gbd->ring, len);
+	if (!per) {
+		atomic_fetch_add_explicit(&gbd->periods_dropped, 1,
+					  memory_order_relaxed);
+		return;
+	}
+	per->tstamp = tstamp;
+	per->frames = size;
+	per->seq = 0;
+	gbd_interleave(gbd, per->pcm, areas, offset, size);
+	gbd_ring_commit(gbd->ring, len);
+
+	atomic_fetch_add_explicit(&gbd->periods_queued, 1,
+				  memory_order_relaxed);
+	fill = gbd_ring_fill(gbd->ring);
+	max = atomic_load_explicit(&gbd->ring_fill_max, memory_order_relaxed);
+	if (fill > max)
+		atomic_store_explicit(&gbd->ring_fill_max, fill,
+				      memory_order_relaxed);
+	sem_post(&gbd->wakeup);
+}
+
+/* output latency as the alsa slave reports it, every
+ * GBD_DELAY_INTERVAL; on the alsa thread, which may query the pcm, for
+ * the sending thread to pass on */
+static void gbd_delay_sample(snd_pcm_gbdclient_t *gbd, int64_t now)
+{
+	snd_pcm_sframes_t frames;
+	unsigned int rate = gbd->ext.rate;
+
+	if (now - gbd->delay_at < GBD_DELAY_INTERVAL * 1000000LL)
+		return;
+	gbd->delay_at = now;
+	if (!rate || snd_pcm_delay(gbd->ext.pcm, &frames) < 0 || frames < 0)
+		return;
+	atomic_store_explicit(&gbd->out_delay,
+			      (int)((int64_t)frames * 1000000 / rate),
+			      memory_order_relaxed);
+}
+
+/*
+ * func: gbdclient_transfer
+ * desc: this function is invoked by the alsa-lib runtime and
+ *       receives the alsa period pcm signal in the slave's float,
+ *       s16 or s32 format, interleaved or not;
+ *       it is responsible for sending the signal to the gbdserver
+ *       for analysis as well as for passing the signal to the 
+ *       configured alsa pcm slave.
+ *
+ *       plugin writers wishing to port this pcm plugin to a standalone
+ *       audio application platform or some other operating system's 
+ *       sound framework should consult the documentation on the 
+ *       GBD github wiki for more details.
+ */
+static snd_pcm_sframes_t gbdclient_transfer(snd_pcm_extplug_t * ext,
+				     const snd_pcm_channel_area_t * dst_areas,
+				     snd_pcm_uframes_t dst_offset,
+				     const snd_pcm_channel_area_t * src_areas,
+				     snd_pcm_uframes_t src_offset,
+				     snd_pcm_uframes_t size)
+{
+	snd_pcm_gbdclient_t *gbd = (snd_pcm_gbdclient_t *) ext;
+	size_t nbytes = size * gbd->achannels * sizeof(float);
+	struct timespec now;
+	gbd_span_t span;
+	int queued;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	span.tstamp = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	span.frames = size;
+	gbd_hist_observe(&gbd->period_frames, size);
+	gbd_delay_sample(gbd, span.tstamp);
+
+	/* no gbdserver: the link thread is reconnecting */
+	if (atomic_load(&gbd->link) != GBD_LINK_UP)
+		goto offline;
+
+	if (gbd->async) {
+		gbd_async_queue(gbd, src_areas, src_offset, size, span.tstamp);
+		goto passthrough;
+	}
+
+	/* send audio signal to gbdserver for analysis, unless a
+	 * handshake holds the link, the socket is backed up or the
+	 * gbdserver is behind */
+	if (pthread_mutex_trylock(&gbd->link_lock))
+		goto offline;
+	if (atomic_load(&gbd->link) != GBD_LINK_UP) {
+		pthread_mutex_unlock(&gbd->link_lock);
+		goto offline;
+	}
+	queued = gbd_tcp_queued(gbd);
+	if (gbd_tcp_busy(gbd, queued, nbytes)) {
+		atomic_fetch_add_explicit(&gbd->periods_busy, 1,
+					  memory_order_relaxed);
+	} else if (!gbd_tcp_behind(gbd, queued, 1)) {
+		span.pcm = gbd_analysis_frames(gbd, src_areas, src_offset, size);
+		if (gbd_send_timed(gbd, &gbd->enc, &span, 1) < 0)
+			gbd_link_lost(gbd);
+	}
+	pthread_mutex_unlock(&gbd->link_lock);
+	goto passthrough;
+
+offline:
+	atomic_fetch_add_explicit(&gbd->periods_offline, 1,
+				  memory_order_relaxed);
+passthrough:
+	/* pass audio signal to alsa pcm slave, in whatever format and
+	 * layout it came */
+	snd_pcm_areas_copy(dst_areas, dst_offset, src_areas, src_offset,
+			   gbd->channels, size, gbd->format);
+	return size;
+}
+
+static int gbdclient_close(snd_pcm_extplug_t * ext)
+{
+	snd_pcm_gbdclient_t *gbd = ext->private_data;
+	gbd_msg_t msg;
+
+	gbd_link_stop(gbd);
+	gbd_async_stop(gbd);
+	gbd_metrics_stop(&gbd->metrics);
+	gbd_trace_close(gbd->trace);
+
+	if (atomic_load(&gbd->link) == GBD_LINK_UP) {
+		msg.cmd = GBD_PCM_PLUGIN_CLOSE;
+		if (gbd_write(gbd->fd, &msg, sizeof(msg)) < 0) {
+			SNDERR("WARNING: gbd server-side PCM plugin release failed!");
+		}
+	}
+	if (gbd->fd >= 0)
+		close(gbd->fd); 
+	if (gbd->udp_fd >= 0)
+		close(gbd->udp_fd);
+	gbd_shm_close(gbd);
+	free((char *)gbd->ipaddr);
+	free((char *)gbd->port);
+	if (gbd->async)
+		sem_destroy(&gbd->wakeup);
+	sem_destroy(&gbd->link_wakeup);
+	pthread_mutex_destroy(&gbd->link_lock);
+	gbd_encoder_free(&gbd->enc);
+	gbd_encoder_free(&gbd->sender_enc);
+	gbd_features_free(&gbd->feat);
+	free(gbd->feat_out);
+	free(gbd->ring);
+	free(gbd->raw);
+	free(gbd->pcm);
+	free(gbd->tmp);
+	free(gbd->sender_pcm);
+	free(gbd->sender_tmp);
+	free(gbd);
+	return 0;
+}
+
+static const char *gbd_encoding_name(int encoding)
+{
+	switch (encoding) {
+	case GBD_ENCODING_S16:
+		return "s16";
+	case GBD_ENCODING_RICE:
+		return "rice";
+	default:
+		return "float";
+	}
+}
+
+static void gbdclient_dump(snd_pcm_extplug_t * ext, snd_output_t * out)
+{
+	snd_pcm_gbdclient_t *gbd = ext->private_data;
+	unsigned long long sent = atomic_load(&gbd->bytes_sent);
+	unsigned long long raw = atomic_load(&gbd->bytes_raw);
+	struct timespec now;
+	double secs;
+
+	snd_output_printf(out, "GBD client PCM%s%s\n",
+			  gbd->stream[0] ? ", stream " : "", gbd->stream);
+	if (ext->pcm)
+		snd_pcm_dump_setup(ext->pcm, out);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = (now.tv_sec - gbd->t_start.tv_sec) +
+	    (now.tv_nsec - gbd->t_start.tv_nsec) / 1e9;
+	snd_output_printf(out, "  link       : %s (protocol v%d), %lu reconnects, "
+			  "periods dropped: %lu offline, %lu socket busy\n",
+			  atomic_load(&gbd->link) == GBD_LINK_UP ? "up" : "down",
+			  gbd->proto, gbd->reconnects, atomic_load(&gbd->periods_offline),
+			  atomic_load(&gbd->periods_busy));
+	if (gbd->shed_latency > 0)
+		snd_output_printf(out, "  shedding   : %lu periods in %lu events "
+				  "(over %ld ms behind)%s\n",
+				  atomic_load(&gbd->periods_shed),
+				  atomic_load(&gbd->shed_events), gbd->shed_latency,
+				  gbd->shedding ? ", shedding now" : "");
+	snd_output_printf(out, "  encoding   : %s (%s requested)\n",
+			  gbd_encoding_name(gbd->wire),
+			  gbd_encoding_name(gbd->encoding));
+	if (gbd->delay_ok)
+		snd_output_printf(out, "  out delay  : %d us (%d us sent)\n",
+				  atomic_load(&gbd->out_delay), gbd->delay_sent);
+	if (gbd->mixing)
+		snd_output_printf(out, "  downmix    : %d to %d channels for "
+				  "analysis\n", gbd->channels, gbd->achannels);
+	if (gbd->features && gbd->feat.engine == GBD_FEATURE_IIR)
+		snd_output_printf(out, "  features   : %u %sbands every %u frames "
+				  "(%s iir filterbank), %lu vectors sent%s\n",
+				  gbd->feat.bands,
+				  gbd->feat_table ? "listed " : "", gbd->feat.hop,
+				  gbd->feat.iir.backend, gbd->feat_vectors,
+				  gbd->feat_tstamps ? ", timestamped" : "");
+	else if (gbd->features)
+		snd_output_printf(out, "  features   : %u %sbands every %u frames "
+				  "(%u point %s transform, %u ns), %lu vectors sent%s\n",
+				  gbd->feat.bands, gbd->feat_table ? "listed " : "",
+				  gbd->feat.hop, gbd->feat.size,
+				  gbd->feat.fft.backend, gbd->feat.fft.ns,
+				  gbd->feat_vectors,
+				  gbd->feat_tstamps ? ", timestamped" : "");
+	if (gbd->shm)
+		snd_output_printf(out, "  transport  : shm %s, %u/%u bytes queued, "
+				  "%lu periods, %u dropped (ring overflow)\n",
+				  gbd->shm_name, gbd_ring_fill(gbd_shm_ring(gbd->shm)),
+				  gbd_shm_ring(gbd->shm)->size, gbd->shm_periods,
+				  atomic_load(&gbd->shm->dropped));
+	else if (gbd->udp_fd >= 0)
+		snd_output_printf(out, "  transport  : udp, session %d, "
+				  "%lu datagrams sent, %lu dropped (socket full)\n",
+				  gbd->session, atomic_load(&gbd->dgrams_sent),
+				  atomic_load(&gbd->dgrams_dropped));
+	else
+		snd_output_printf(out, "  transport  : tcp%s\n",
+				  gbd->tstamps ? ", timestamped" : "");
+	snd_output_printf(out, "  traffic    : %llu bytes sent for %llu float bytes, "
+			  "%.0f bytes/s saved\n",
+			  sent, raw, gbd->t_start.tv_sec && secs > 0 ?
+			  ((double)raw - sent) / secs : 0.0);
+	if (!gbd->async || gbd->shm)
+		return;
+	snd_output_printf(out, "  async ring : %u/%u bytes (max %u)\n",
+			  gbd->ring ? gbd_ring_fill(gbd->ring) : 0,
+			  gbd->ring ? gbd->ring->size : 0,
+			  atomic_load(&gbd->ring_fill_max));
+	snd_output_printf(out, "  periods    : %lu queued, %lu dropped (ring overflow)\n",
+			  atomic_load(&gbd->periods_queued),
+			  atomic_load(&gbd->periods_dropped));
+	snd_output_printf(out, "  batches    : %lu sent\n",
+			  atomic_load(&gbd->batches_sent));
+}
+
+/* the metrics endpoint's scrape; the counters of the dump, for
+ * Prometheus */
+static void gbd_metrics_write(FILE *out, void *ctx)
+{
+	snd_pcm_gbdclient_t *gbd = ctx;
+	unsigned long queued = 0;
+
+	if (gbd->shm)
+		queued = gbd_ring_fill(gbd_shm_ring(gbd->shm));
+	else if (gbd->udp_fd < 0)
+		queued = atomic_load(&gbd->backlog);
+	if (gbd->async && gbd->ring)
+		queued += gbd_ring_fill(gbd->ring);
+
+	fprintf(out, "# HELP gbdclient_periods_total Periods played, by what "
+		"became of their analysis copy.\n"
+		"# TYPE gbdclient_periods_total counter\n");
+	fprintf(out, "gbdclient_periods_total{fate=\"sent\"} %lu\n",
+		atomic_load(&gbd->periods_sent));
+	fprintf(out, "gbdclient_periods_total{fate=\"offline\"} %lu\n",
+		atomic_load(&gbd->periods_offline));
+	fprintf(out, "gbdclient_periods_total{fate=\"busy\"} %lu\n",
+		atomic_load(&gbd->periods_busy));
+	fprintf(out, "gbdclient_periods_total{fate=\"shed\"} %lu\n",
+		atomic_load(&gbd->periods_shed));
+	fprintf(out, "gbdclient_periods_total{fate=\"overflow\"} %lu\n",
+		atomic_load(&gbd->periods_dropped) +
+		(gbd->shm ? atomic_load(&gbd->shm->dropped) : 0));
+	gbd_metric_print(out, "gbdclient_link_up", "gauge",
+			 "Whether the gbdserver link is up.",
+			 atomic_load(&gbd->link) == GBD_LINK_UP);
+	gbd_metric_print(out, "gbdclient_reconnects_total", "counter",
+			 "Reconnections with the gbdserver.", gbd->reconnects);
+	gbd_metric_print(out, "gbdclient_shed_events_total", "counter",
+			 "Times the gbdserver fell behind realtime.",
+			 atomic_load(&gbd->shed_events));
+	gbd_metric_print(out, "gbdclient_sent_bytes_total", "counter",
+			 "Bytes sent to the gbdserver.",
+			 atomic_load(&gbd->bytes_sent));
+	gbd_metric_print(out, "gbdclient_float_bytes_total", "counter",
+			 "Bytes the sent analysis stream takes as float.",
+			 atomic_load(&gbd->bytes_raw));
+	if (gbd->udp_fd >= 0) {
+		gbd_metric_print(out, "gbdclient_datagrams_total", "counter",
+				 "Datagrams sent.",
+				 atomic_load(&gbd->dgrams_sent));
+		gbd_metric_print(out, "gbdclient_datagrams_dropped_total",
+				 "counter", "Datagrams dropped, socket full.",
+				 atomic_load(&gbd->dgrams_dropped));
+	}
+	gbd_metric_print(out, "gbdclient_queue_bytes", "gauge",
+			 "Bytes queued towards the gbdserver.", queued);
+	gbd_metric_print(out, "gbdclient_output_delay_seconds", "gauge",
+			 "Latency of the alsa slave.",
+			 atomic_load(&gbd->out_delay) * 1e-6);
+	gbd_hist_print(out, "gbdclient_period_frames",
+		       "Frames per period played.", &gbd->period_frames, 1.0);
+	gbd_hist_print(out, "gbdclient_send_seconds",
+		       "Time taken to send a run of periods.",
+		       &gbd->send_us, 1e-6);
+}
+
+/* largest transfer alsa may hand us */
+static snd_pcm_uframes_t gbd_buffer_frames(snd_pcm_extplug_t * ext)
+{
+	snd_pcm_hw_params_t *params;
+	snd_pcm_uframes_t frames = 0;
+
+	if (snd_pcm_hw_params_malloc(&params) == 0) {
+		if (snd_pcm_hw_params_current(ext->pcm, params) == 0)
+			snd_pcm_hw_params_get_buffer_size(params, &frames);
+		snd_pcm_hw_params_free(params);
+	}
+	return frames ? frames : ext->rate / 2;
+}
+
+/*
+ * Offers the gbdserver at ipaddr:port left unanswered, kept for the
+ * life of the process. The gbdserver shipped so far skips commands it
+ * does not know without a reply, so an offer is waited for
+ * (GBD_OFFER_TIMEOUT, GBD_IO_TIMEOUT for a v2 GBD_HELLO) once and from
+ * then on no longer made to it: a
+ * player opening the pcm for every track only waits on the first.
+ */
+typedef struct __gbd_peer {
+	char addr[128];			/* ipaddr:port, "" if free */
+	unsigned int unanswered;	/* GBD_OFFER_* */
+} gbd_peer_t;
+
+static gbd_peer_t gbd_peers[GBD_PEERS_MAX];
+static pthread_mutex_t gbd_peers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the entry of the gbdserver, added if add; NULL if there is none or
+ * no room. Called with gbd_peers_lock held. */
+static gbd_peer_t *gbd_peer_find(snd_pcm_gbdclient_t *gbd, int add)
+{
+	char addr[sizeof(gbd_peers[0].addr)];
+	int i;
+
+	if (snprintf(addr, sizeof(addr), "%s:%s", gbd->ipaddr,
+		     gbd->port) >= (int)sizeof(addr))
+		return NULL;
+	for (i = 0; i < GBD_PEERS_MAX; i++)
+		if (strcmp(gbd_peers[i].addr, addr) == 0)
+			return &gbd_peers[i];
+	for (i = 0; add && i < GBD_PEERS_MAX; i++)
+		if (!gbd_peers[i].addr[0]) {
+			strcpy(gbd_peers[i].addr, addr);
+			return &gbd_peers[i];
+		}
+	return NULL;
+}
+
+/* whether the gbdserver left the offer unanswered before */
+static int gbd_peer_unanswered(snd_pcm_gbdclient_t *gbd, unsigned int offer)
+{
+	gbd_peer_t *peer;
+	int ret;
+
+	pthread_mutex_lock(&gbd_peers_lock);
+	peer = gbd_peer_find(gbd, 0);
+	ret = peer && (peer->unanswered & offer);
+	pthread_mutex_unlock(&gbd_peers_lock);
+	return ret;
+}
+
+/* remembers the offer as unanswered by the gbdserver */
+static void gbd_peer_mark(snd_pcm_gbdclient_t *gbd, unsigned int offer)
+{
+	gbd_peer_t *peer;
+
+	pthread_mutex_lock(&gbd_peers_lock);
+	peer = gbd_peer_find(gbd, 1);
+	if (peer)
+		peer->unanswered |= offer;
+	pthread_mutex_unlock(&gbd_peers_lock);
+}
+
+/* whether fd has data within ms: 1, 0 if not, -1 on error */
+static int gbd_readable(int fd, int ms)
+{
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while ((ret = poll(&pfd, 1, ms)) < 0 && errno == EINTR)
+		;
+	return ret < 0 ? -1 : ret;
+}
+
+/*
+ * func: gbd_offer_reply
+ * desc: reads the reply to an optional offer, waiting no more than ms
+ *       for it to start. Returns 0 with the reply in msg, -ETIMEDOUT
+ *       if none came, upon which the offer is remembered as unanswered
+ *       (see gbd_peer_t), or -EIO if the connection failed.
+ */
+static int gbd_offer_reply(snd_pcm_gbdclient_t *gbd, unsigned int offer,
+			   gbd_msg_t *msg, int ms)
+{
+	int ret;
+
+	ret = gbd_readable(gbd->fd, ms);
+	if (ret == 0) {
+		gbd_peer_mark(gbd, offer);
+		return -ETIMEDOUT;
+	}
+	if (ret < 0 || gbd_read(gbd->fd, msg, sizeof(*msg)) != sizeof(*msg))
+		return -EIO;
+	return 0;
+}
+
+/* sets up the band energy extractor for the stream and describes it
+ * in cfg, for the offer to the gbdserver; with table, on the bands of
+ * the band list, which cfg describes the log spaced fallback of */
+static int gbd_features_setup(snd_pcm_gbdclient_t *gbd,
+			      gbd_feature_cfg_t *cfg, int table)
+{
+	unsigned int hop = gbd->rate * gbd->feature_hop / 1000;
+	float lo[GBD_FEATURE_BANDS_MAX], hi[GBD_FEATURE_BANDS_MAX];
+	unsigned int b;
+	int err;
+
+	gbd->features = 0;
+	gbd_features_free(&gbd->feat);
+	free(gbd->feat_out);
+	gbd->feat_out = NULL;
+
+	if (gbd->feature_window && gbd->feature_window < hop) {
+		SNDERR("feature_window is shorter than the %u frame hop", hop);
+		return -EINVAL;
+	}
+	err = gbd_features_init(&gbd->feat, gbd->rate, gbd->achannels,
+				gbd->achannels - gbd->lfe_forward,
+				gbd->band_list_len ? gbd->band_list_len :
+				gbd->feature_bands, hop, gbd->feature_window,
+				gbd->feature_engine);
+	if (err < 0) {
+		SNDERR("Invalid gbd feature extraction settings");
+		return err;
+	}
+	if (table) {
+		for (b = 0; b < gbd->band_list_len; b++) {
+			lo[b] = gbd->band_list[b].fmin;
+			hi[b] = gbd->band_list[b].fmax;
+		}
+		err = gbd_features_set_bands(&gbd->feat, lo, hi);
+		if (err < 0) {
+			SNDERR("feature_band_list does not fit the %u Hz rate",
+			       gbd->rate);
+			return err;
+		}
+	}
+	gbd->feat_max = gbd->buffer_frames / gbd->feat.hop + 1;
+	gbd->feat_out = malloc(gbd->feat_max * gbd->feat.bands * sizeof(float));
+	if (!gbd->feat_out)
+		return -ENOMEM;
+
+	cfg->bands = gbd->feat.bands;
+	cfg->hop = gbd->feat.hop;
+	cfg->size = gbd->feat.size;
+	cfg->fmin = GBD_FEATURE_FMIN;
+	cfg->fmax = gbd->feat.fmax;
+	return 0;
+}
+
+static void gbd_features_declined(snd_pcm_gbdclient_t *gbd)
+{
+	SNDERR("gbdserver declined feature vectors, sending pcm");
+	gbd_features_free(&gbd->feat);
+	free(gbd->feat_out);
+	gbd->feat_out = NULL;
+}
+
+/*
+ * func: gbd_shm_negotiate
+ * desc: offers a fresh shared memory ring to the local gbdserver;
+ *       when it is declined (or cannot be created), the audio stays
+ *       on the socket.
+ */
+static int gbd_shm_negotiate(snd_pcm_gbdclient_t *gbd, unsigned int rate)
+{
+	gbd_shm_cfg_t cfg;
+	gbd_msg_t msg;
+	int err;
+
+	gbd_shm_close(gbd);
+	if (gbd_peer_unanswered(gbd, GBD_OFFER_TRANSPORT)) {
+		SNDERR("gbdserver does not take shared memory transport, "
+		       "using tcp");
+		return 0;
+	}
+	err = gbd_shm_open(gbd, rate);
+	if (err < 0) {
+		SNDERR("Failed to create gbd shared memory ring (%s), using tcp",
+		       strerror(-err));
+		return 0;
+	}
+
+	memset(&cfg, 0, sizeof(cfg));
+	strcpy(cfg.name, gbd->shm_name);
+	cfg.bytes = gbd->shm_bytes;
+	msg.cmd = GBD_PCM_TRANSPORT;
+	msg.data = GBD_TRANSPORT_SHM;
+	if (gbd_write(gbd->fd, &msg, sizeof(msg)) < 0 ||
+	    gbd_write(gbd->fd, &cfg, sizeof(cfg)) < 0) {
+		SNDERR("gbd_write failed! (transport)");
+		shm_unlink(gbd->shm_name);
+		gbd_shm_close(gbd);
+		return -EIO;
+	}
+	err = gbd_offer_reply(gbd, GBD_OFFER_TRANSPORT, &msg, GBD_OFFER_TIMEOUT);
+	/* mapped on both ends by now, or not wanted */
+	shm_unlink(gbd->shm_name);
+	if (err == 0 && msg.cmd == GBD_SUCCESS)
+		return 0;
+	if (err == -EIO) {
+		gbd_shm_close(gbd);
+		return -EIO;
+	}
+
+	SNDERR("gbdserver declined shared memory transport, using tcp");
+	gbd_shm_close(gbd);
+	return 0;
+}
+
+/* per connection socket setup */
+static void gbd_sockopts(snd_pcm_gbdclient_t *gbd, int fd)
+{
+	struct timeval tv;
+	socklen_t len = sizeof(gbd->sndbuf);
+	int one = 1;
+
+	/* a wedged gbdserver fails the connection instead of stalling
+	 * the sending thread (and the handshake) for ever */
+	tv.tv_sec = GBD_IO_TIMEOUT / 1000;
+	tv.tv_usec = (GBD_IO_TIMEOUT % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	/* control messages and periods are small and latency bound, so
+	 * no Nagle; fails harmlessly on a unix socket */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	/* the kernel reports twice the usable size */
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &gbd->sndbuf, &len) < 0)
+		gbd->sndbuf = 0;
+	gbd->sndbuf /= 2;
+}
+
+/* load gbd server-side DSP LADSPA library module; in protocol v2 the
+ * GBD_HELLO of the handshake does this */
+static int gbd_hello(snd_pcm_gbdclient_t *gbd)
+{
+	gbd_msg_t msg;
+	int err;
+
+	/* a gbdserver that left a GBD_HELLO unanswered gets v1 */
+	if (gbd->proto >= GBD_PROTO_VERSION &&
+	    gbd_peer_unanswered(gbd, GBD_OFFER_HELLO))
+		gbd->proto = 1;
+	if (gbd->proto >= GBD_PROTO_VERSION)
+		return 0;
+
+	msg.cmd = GBD_LADSPA_LIB_INIT;
+	err = gbd_write(gbd->fd, &msg, sizeof(msg));
+	if (err < 0)
+		return -EIO;
+
+	err = gbd_read(gbd->fd, &msg, sizeof(msg));
+	if (err != sizeof(msg) || msg.cmd == GBD_ERROR)
+		return -EIO;
+	return 0;
+}
+
+/* udp socket for an accepted udp transport, none otherwise */
+static void gbd_udp_setup(snd_pcm_gbdclient_t *gbd, int accepted)
+{
+	if (accepted) {
+		if (gbd->udp_fd < 0)
+			gbd->udp_fd = gbd_connect(gbd->ipaddr, gbd->port,
+						  SOCK_DGRAM);
+		if (gbd->udp_fd < 0)
+			SNDERR("Failed to open gbd udp socket");
+		return;
+	}
+	if (gbd->udp_fd >= 0)
+		close(gbd->udp_fd);
+	gbd->udp_fd = -1;
+}
+
+/* the gbdserver takes stereo only: the forwarded LFE goes, for the
+ * life of the instance; buffers sized for it stay big enough */
+static void gbd_lfe_drop(snd_pcm_gbdclient_t *gbd)
+{
+	SNDERR("gbdserver takes two analysis channels only, dropping "
+	       "lfe_forward");
+	gbd->mixer.out--;
+	gbd->achannels--;
+	gbd->lfe_forward = 0;
+}
+
+/*
+ * func: gbd_handshake_v2
+ * desc: protocol v2 handshake; makes all the offers of the v1 message
+ *       sequence (see gbd_handshake_v1()) in one GBD_HELLO frame and
+ *       applies the one reply. Returns -EPROTO when the gbdserver only
+ *       speaks v1, -ENOTSUP when it reads stereo only and the stream,
+ *       now without its forwarded LFE, has to be set up afresh, -EIO
+ *       when the connection failed.
+ */
+static int gbd_handshake_v2(snd_pcm_gbdclient_t *gbd)
+{
+	gbd_hello_reply_t reply;
+	gbd_hello_t hello;
+	struct iovec iov[3];
+	gbd_msg_t msg;
+	char skip[64];
+	int err, n;
+
+	memset(&hello, 0, sizeof(hello));
+	hello.version = GBD_PROTO_VERSION;
+	hello.channels = gbd->achannels;
+	hello.rate = gbd->rate;
+	hello.encoding = gbd->encoding;
+	hello.transport = gbd->transport;
+	strcpy(hello.stream, gbd->stream);
+
+	gbd->features = 0;
+	if (gbd->mode == GBD_MODE_FEATURES) {
+		err = gbd_features_setup(gbd, &hello.features,
+					 gbd->band_list_len > 0);
+		if (err < 0)
+			return err;
+		hello.flags |= GBD_HELLO_FEATURES | GBD_HELLO_FEATURE_TSTAMP;
+		if (gbd->band_list_len)
+			hello.flags |= GBD_HELLO_FEATURE_BANDS;
+	}
+	hello.flags |= GBD_HELLO_DELAY | GBD_HELLO_TSTAMP;
+	if (gbd->achannels != 2)
+		hello.flags |= GBD_HELLO_CHANNELS;
+
+	gbd_shm_close(gbd);
+	if (hello.transport == GBD_TRANSPORT_SHM) {
+		err = gbd_shm_open(gbd, gbd->rate);
+		if (err < 0) {
+			SNDERR("Failed to create gbd shared memory ring (%s), "
+			       "using tcp", strerror(-err));
+			hello.transport = GBD_TRANSPORT_TCP;
+		} else {
+			strcpy(hello.shm.name, gbd->shm_name);
+			hello.shm.bytes = gbd->shm_bytes;
+		}
+	}
+
+	iov[0].iov_base = &msg;
+	iov[0].iov_len = sizeof(msg);
+	iov[1].iov_base = &hello;
+	iov[1].iov_len = sizeof(hello);
+	iov[2].iov_base = gbd->band_list;
+	iov[2].iov_len = hello.flags & GBD_HELLO_FEATURE_BANDS ?
+	    gbd->band_list_len * sizeof(gbd_band_cfg_t) : 0;
+	msg.cmd = GBD_HELLO;
+	msg.data = iov[1].iov_len + iov[2].iov_len;
+	if (gbd_writev(gbd->fd, iov, 3) < 0) {
+		SNDERR("gbd_write failed! (hello)");
+		err = -EIO;
+		goto out;
+	}
+
+	/* a v1 gbdserver reads the frame as commands: mostly no reply,
+	 * but one of a command some field happened to make (e.g. a udp
+	 * transport in a cmd slot). Anything but a whole v2 reply makes it
+	 * a v1 gbdserver, which gbd_hello() no longer sends a hello to. */
+	err = -EPROTO;
+	if (gbd_offer_reply(gbd, GBD_OFFER_HELLO, &msg, GBD_IO_TIMEOUT) < 0)
+		goto out;
+	if (msg.cmd != GBD_SUCCESS || msg.data < (int32_t)sizeof(reply) ||
+	    msg.data > GBD_HELLO_REPLY_MAX ||
+	    gbd_readable(gbd->fd, GBD_OFFER_TIMEOUT) <= 0 ||
+	    gbd_read(gbd->fd, &reply, sizeof(reply)) != sizeof(reply) ||
+	    reply.version < GBD_PROTO_VERSION) {
+		gbd_peer_mark(gbd, GBD_OFFER_HELLO);
+		goto out;
+	}
+	/* skip the fields of later versions */
+	for (msg.data -= sizeof(reply); msg.data > 0; msg.data -= n) {
+		n = msg.data < (int32_t)sizeof(skip) ?
+		    msg.data : (int32_t)sizeof(skip);
+		if (gbd_read(gbd->fd, skip, n) != n) {
+			err = -EIO;
+			goto out;
+		}
+	}
+	err = 0;
+
+	if ((hello.flags & GBD_HELLO_CHANNELS) &&
+	    !(reply.flags & GBD_HELLO_CHANNELS)) {
+		gbd_lfe_drop(gbd);
+		err = -ENOTSUP;
+		goto out;
+	}
+
+	gbd->delay_ok = !!(reply.flags & GBD_HELLO_DELAY);
+	gbd->delay_sent = 0;
+	gbd->tstamps = !!(reply.flags & GBD_HELLO_TSTAMP);
+	gbd->session = reply.session;
+
+	if (hello.flags & GBD_HELLO_FEATURES) {
+		gbd->features = !!(reply.flags & GBD_HELLO_FEATURES);
+		if (!gbd->features)
+			gbd_features_declined(gbd);
+	}
+	gbd->feat_tstamps = gbd->features &&
+	    (reply.flags & GBD_HELLO_FEATURE_TSTAMP);
+	gbd->feat_table = gbd->features &&
+	    (hello.flags & GBD_HELLO_FEATURE_BANDS) &&
+	    (reply.flags & GBD_HELLO_FEATURE_BANDS);
+	if (gbd->features && (hello.flags & GBD_HELLO_FEATURE_BANDS) &&
+	    !gbd->feat_table) {
+		SNDERR("gbdserver ignored feature_band_list, sending log "
+		       "spaced bands");
+		err = gbd_features_setup(gbd, &hello.features, 0);
+		if (err < 0)
+			goto out;
+		gbd->features = 1;
+	}
+
+	if (gbd->shm && (gbd->features ||
+			 reply.transport != GBD_TRANSPORT_SHM)) {
+		if (!gbd->features)
+			SNDERR("gbdserver declined shared memory transport, "
+			       "using tcp");
+		gbd_shm_close(gbd);
+	}
+
+	gbd->wire = GBD_ENCODING_FLOAT;
+	if (!gbd->features && !gbd->shm &&
+	    reply.encoding == gbd->encoding)
+		gbd->wire = gbd->encoding;
+	else if (!gbd->features && !gbd->shm &&
+		 gbd->encoding != GBD_ENCODING_FLOAT)
+		SNDERR("gbdserver declined %s encoding, sending float",
+		       gbd_encoding_name(gbd->encoding));
+
+	if (hello.transport == GBD_TRANSPORT_UDP && !gbd->features) {
+		if (reply.transport != GBD_TRANSPORT_UDP)
+			SNDERR("gbdserver declined udp transport, using tcp");
+		gbd_udp_setup(gbd, reply.transport == GBD_TRANSPORT_UDP);
+	}
+
+out:
+	/* mapped on both ends by now, or not wanted */
+	if (gbd->shm)
+		shm_unlink(gbd->shm_name);
+	if (err < 0)
+		gbd_shm_close(gbd);
+	return err;
+}
+
+/* replaces the connection with a fresh one, for gbd->proto */
+static int gbd_reconnect(snd_pcm_gbdclient_t *gbd)
+{
+	int fd;
+
+	fd = gbd_connect(gbd->ipaddr, gbd->port, SOCK_STREAM);
+	if (fd < 0)
+		return -EIO;
+	/* the link thread may be polling the old one, which close()
+	 * alone would only hang up once the poll returns */
+	if (gbd->fd >= 0) {
+		shutdown(gbd->fd, SHUT_RDWR);
+		close(gbd->fd);
+	}
+	gbd->fd = fd;
+	gbd_sockopts(gbd, fd);
+	return gbd_hello(gbd);
+}
+
+/* protocol v1 handshake, one message per parameter or offer */
+static int gbd_handshake_v1(snd_pcm_gbdclient_t *gbd)
+{
+	int srate = gbd->rate;
+	int err;
+	gbd_msg_t msg;
+
+	gbd->delay_ok = 0;
+	gbd->tstamps = 0;
+	gbd->feat_tstamps = 0;
+	gbd->feat_table = 0;
+	if (gbd->stream[0])
+		SNDERR("gbdserver speaks v1, stream %s goes to the default "
+		       "segment", gbd->stream);
+	if (gbd->lfe_forward)
+		gbd_lfe_drop(gbd);
+
+	/* prepare to initialize gbdserver-side pcm plugin */
+	msg.cmd = GBD_CLIENT_CHANNELS;
+	msg.data = gbd->achannels;
+	err = gbd_write(gbd->fd, &msg, sizeof(msg));
+	if (err < 0) {
+		SNDERR("gbd_write failed! (channels)");
+		return -EIO;
+	}
+
+ 	msg.cmd = GBD_AUDIO_SAMPLE_RATE;
+	msg.data = srate;
+	err = gbd_write(gbd->fd, &msg, sizeof(msg));
+	if (err < 0) {
+		SNDERR("gbd_write failed! (sampel rate)");
+		return -EIO;
+	}
+
+	/* band energies are offered in the v2 hello only: their
+	 * configuration is no multiple of gbd_msg_t, which a v1 gbdserver
+	 * would read as commands */
+	gbd->features = 0;
+	if (gbd->mode == GBD_MODE_FEATURES)
+		SNDERR("gbdserver speaks v1, sending pcm in place of feature "
+		       "vectors");
+
+	/* local gbdserver: hand the periods over in shared memory */
+	gbd_shm_close(gbd);
+	if (gbd->transport == GBD_TRANSPORT_SHM && !gbd->features) {
+		err = gbd_shm_negotiate(gbd, srate);
+		if (err < 0)
+			return err;
+	}
+
+	/* negotiate a compact wire encoding, else stay with float */
+	gbd->wire = GBD_ENCODING_FLOAT;
+	if (gbd->encoding != GBD_ENCODING_FLOAT && !gbd->features &&
+	    !gbd->shm && !gbd_peer_unanswered(gbd, GBD_OFFER_ENCODING)) {
+		msg.cmd = GBD_PCM_ENCODING;
+		msg.data = gbd->encoding;
+		err = gbd_write(gbd->fd, &msg, sizeof(msg));
+		if (err < 0) {
+			SNDERR("gbd_write failed! (encoding)");
+			return -EIO;
+		}
+		err = gbd_offer_reply(gbd, GBD_OFFER_ENCODING, &msg,
+				      GBD_OFFER_TIMEOUT);
+		if (err == -EIO)
+			return err;
+		if (err == 0 && msg.cmd == GBD_SUCCESS)
+			gbd->wire = gbd->encoding;
+	}
+	if (gbd->encoding != GBD_ENCODING_FLOAT && !gbd->features &&
+	    !gbd->shm && gbd->wire == GBD_ENCODING_FLOAT)
+		SNDERR("gbdserver declined %s encoding, sending float",
+		       gbd_encoding_name(gbd->encoding));
+
+	/* move the audio to udp datagrams if the gbdserver agrees */
+	if (gbd->transport == GBD_TRANSPORT_UDP && !gbd->features) {
+		err = -ETIMEDOUT;
+		if (!gbd_peer_unanswered(gbd, GBD_OFFER_TRANSPORT)) {
+			msg.cmd = GBD_PCM_TRANSPORT;
+			msg.data = GBD_TRANSPORT_UDP;
+			err = gbd_write(gbd->fd, &msg, sizeof(msg));
+			if (err < 0) {
+				SNDERR("gbd_write failed! (transport)");
+				return -EIO;
+			}
+			err = gbd_offer_reply(gbd, GBD_OFFER_TRANSPORT, &msg,
+					      GBD_OFFER_TIMEOUT);
+			if (err == -EIO)
+				return err;
+		}
+		if (err == 0 && msg.cmd == GBD_SUCCESS)
+			gbd->session = msg.data;
+		else
+			SNDERR("gbdserver declined udp transport, using tcp");
+		gbd_udp_setup(gbd, err == 0 && msg.cmd == GBD_SUCCESS);
+	}
+
+	/* initialize gbd server-side pcm plugin */
+	msg.cmd = GBD_PCM_PLUGIN_INIT;
+	err = gbd_write(gbd->fd, &msg, sizeof(msg));
+	if (err < 0) {
+		SNDERR("gbd_write failed! (plugin init)");
+		return -EIO;
+	}
+
+	err = gbd_read(gbd->fd, &msg, sizeof(msg));
+	if (err != sizeof(msg) || msg.cmd == GBD_ERROR) {
+		SNDERR("Failed to initialize gbdserver-side PCM plugin module");
+		return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * func: gbd_handshake
+ * desc: (re)initializes the gbdserver-side pcm plugin for the stream
+ *       parameters saved by gbdclient_init() and sets up whatever the
+ *       negotiation settled on; in one round trip with a v2 gbdserver,
+ *       else falling back to v1 for good. Called with link_lock held,
+ *       by gbdclient_init() or by the link thread after a reconnect;
+ *       returns -EIO when the connection failed.
+ */
+static int gbd_handshake(snd_pcm_gbdclient_t *gbd)
+{
+	int err = -EPROTO;
+
+	if (gbd->proto >= GBD_PROTO_VERSION) {
+		err = gbd_handshake_v2(gbd);
+		/* the hello set up more channels than the gbdserver reads */
+		if (err == -ENOTSUP) {
+			err = gbd_reconnect(gbd);
+			if (err == 0)
+				err = gbd_handshake_v2(gbd);
+		}
+		if (err == -EPROTO) {
+			SNDERR("gbdserver speaks protocol v1 only, falling back");
+			gbd->proto = 1;
+			err = gbd_reconnect(gbd);
+			if (err == 0)
+				err = -EPROTO;
+		}
+	}
+	if (err == -EPROTO)
+		err = gbd_handshake_v1(gbd);
+	if (err < 0)
+		return err;
+
+	/* scratch space of the sending thread */
+	gbd_encoder_free(&gbd->enc);
+	gbd_encoder_free(&gbd->sender_enc);
+	if (gbd->wire != GBD_ENCODING_FLOAT || gbd->udp_fd >= 0) {
+		err = gbd_encoder_alloc(gbd->async ? &gbd->sender_enc : &gbd->enc,
+					gbd->buffer_frames, gbd->achannels);
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+
+/* rate limited warning; link thread only */
+static void gbd_link_warn(snd_pcm_gbdclient_t *gbd, const char *what)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (gbd->warn_time &&
+	    now.tv_sec - gbd->warn_time < GBD_WARN_INTERVAL) {
+		gbd->warn_suppressed++;
+		return;
+	}
+	if (gbd->warn_suppressed)
+		fprintf(stderr, "%s:%s:%d:: WARNING!! %s (%lu more since the "
+			"last warning)\n", __FILE__, __func__, __LINE__, what,
+			gbd->warn_suppressed);
+	else
+		fprintf(stderr, "%s:%s:%d:: WARNING!! %s\n",
+			__FILE__, __func__, __LINE__, what);
+	gbd->warn_time = now.tv_sec;
+	gbd->warn_suppressed = 0;
+}
+
+/* sleeps ms unless woken by gbd_link_stop() */
+static void gbd_link_sleep(snd_pcm_gbdclient_t *gbd, long ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	while (sem_timedwait(&gbd->link_wakeup, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/*
+ * func: gbd_link_thread
+ * desc: watches the gbdserver connection while it is up and, once it
+ *       is down, reconnects with exponential backoff and replays the
+ *       whole handshake. Meanwhile the sending threads drop periods
+ *       without touching the socket, so playback never waits for a
+ *       missing gbdserver.
+ */
+static void *gbd_link_thread(void *arg)
+{
+	snd_pcm_gbdclient_t *gbd = arg;
+	long backoff = GBD_RECONNECT_MIN;
+	int up = atomic_load(&gbd->link) == GBD_LINK_UP;
+	struct pollfd pfd;
+	int fd, err;
+
+	while (atomic_load(&gbd->link_running)) {
+		if (atomic_load(&gbd->link) == GBD_LINK_UP) {
+			up = 1;
+			/* the gbdserver never talks unasked, so only a
+			 * hangup is of interest here */
+			pfd.fd = gbd->fd;
+			pfd.events = POLLRDHUP;
+			if (poll(&pfd, 1, GBD_LINK_POLL) > 0 &&
+			    (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+				/* unless a v1 fallback replaced the socket */
+				pthread_mutex_lock(&gbd->link_lock);
+				if (pfd.fd == gbd->fd)
+					gbd_link_lost(gbd);
+				pthread_mutex_unlock(&gbd->link_lock);
+			}
+			continue;
+		}
+
+		if (up)
+			gbd_link_warn(gbd, "lost connection with gbdserver, "
+				      "analysis paused");
+		up = 0;
+		gbd_link_sleep(gbd, backoff);
+		if (!atomic_load(&gbd->link_running))
+			break;
+
+		fd = gbd_connect(gbd->ipaddr, gbd->port, SOCK_STREAM);
+		if (fd < 0) {
+			gbd_link_warn(gbd, "gbdserver unreachable, retrying");
+			if ((backoff *= 2) > GBD_RECONNECT_MAX)
+				backoff = GBD_RECONNECT_MAX;
+			continue;
+		}
+
+		pthread_mutex_lock(&gbd->link_lock);
+		if (gbd->fd >= 0)
+			close(gbd->fd);
+		gbd->fd = fd;
+		gbd_sockopts(gbd, fd);
+		err = gbd_hello(gbd);
+		if (!err && gbd->rate)
+			err = gbd_handshake(gbd);
+		if (!err) {
+			atomic_store(&gbd->link, GBD_LINK_UP);
+			gbd->reconnects++;
+			backoff = GBD_RECONNECT_MIN;
+			fprintf(stderr, "%s:%s:%d:: reconnected with gbdserver\n",
+				__FILE__, __func__, __LINE__);
+		} else {
+			gbd_link_warn(gbd, "gbdserver handshake failed, retrying");
+			if ((backoff *= 2) > GBD_RECONNECT_MAX)
+				backoff = GBD_RECONNECT_MAX;
+		}
+		pthread_mutex_unlock(&gbd->link_lock);
+	}
+	return NULL;
+}
+
+static int gbdclient_init(snd_pcm_extplug_t * ext)
+{
+	snd_pcm_gbdclient_t *gbd = (snd_pcm_gbdclient_t *) ext;
+	int err = 0;
+
+	/* the sender must not interleave periods with the handshake */
+	gbd_async_stop(gbd);
+
+	/* while the link is down, the link thread handshakes with these
+	 * once it gets through */
+	pthread_mutex_lock(&gbd->link_lock);
+	gbd->rate = ext->rate;
+	gbd->buffer_frames = gbd_buffer_frames(ext);
+	gbd->format = ext->format;
+	gbd->width = snd_pcm_format_physical_width(ext->format) / 8;
+	if (atomic_load(&gbd->link) == GBD_LINK_UP) {
+		err = gbd_handshake(gbd);
+		if (err == -EIO) {
+			gbd_link_lost(gbd);
+			err = 0;
+		}
+	}
+	pthread_mutex_unlock(&gbd->link_lock);
+	if (err < 0)
+		return err;
+
+	if (!gbd->t_start.tv_sec)
+		clock_gettime(CLOCK_MONOTONIC, &gbd->t_start);
+
+	free(gbd->raw);
+	free(gbd->pcm);
+	free(gbd->tmp);
+	gbd->raw = NULL;
+	gbd->pcm = NULL;
+	gbd->tmp = NULL;
+	if (!gbd->async) {
+		gbd->raw = malloc(gbd->buffer_frames * gbd->channels * gbd->width);
+		gbd->pcm = malloc(gbd->buffer_frames * gbd->achannels *
+				  sizeof(float));
+		if (gbd->format != SND_PCM_FORMAT_FLOAT && gbd->mixing)
+			gbd->tmp = malloc(gbd->buffer_frames * gbd->channels *
+					  sizeof(float));
+		if (!gbd->raw || !gbd->pcm ||
+		    (gbd->format != SND_PCM_FORMAT_FLOAT && gbd->mixing &&
+		     !gbd->tmp))
+			return -ENOMEM;
+	}
+
+	if (gbd->async) {
+		err = gbd_async_start(gbd, gbd->rate);
+		if (err < 0) {
+			SNDERR("Failed to start gbd async sender");
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static snd_pcm_extplug_callback_t pcm_gbdclient_callback = {
+	.transfer = gbdclient_transfer,
+	.init = gbdclient_init,
+	.close = gbdclient_close,
+	.dump = gbdclient_dump,
+};
+
+/* formats passed through natively */
+static const unsigned int gbd_formats[] = {
+	SND_PCM_FORMAT_FLOAT,
+	SND_PCM_FORMAT_S32,
+	SND_PCM_FORMAT_S16,
+};
+
+/* stream names end up in shm_open(3) names */
+static int gbd_stream_name_ok(const char *name)
+{
+	size_t n = strspn(name, "abcdefghijklmnopqrstuvwxyz"
+			  "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-");
+
+	return name[n] == '\0' && n < GBD_STREAM_NAME_MAX;
+}
+
+/* feature_band_list [ [ fmin fmax threshold history ] .. ]: a row per
+ * band, in Hz; threshold and history may be left out (or 0) for the
+ * gbdserver's defaults */
+static int gbd_parse_band_list(snd_config_t *conf, gbd_band_cfg_t *band,
+			       unsigned int *nbands)
+{
+	snd_config_iterator_t i, next, j, jnext;
+	unsigned int n = 0;
+	double v[4];
+	int c;
+
+	if (snd_config_get_type(conf) != SND_CONFIG_TYPE_COMPOUND)
+		return -EINVAL;
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *row = snd_config_iterator_entry(i);
+
+		if (n == GBD_FEATURE_BANDS_MAX ||
+		    snd_config_get_type(row) != SND_CONFIG_TYPE_COMPOUND)
+			return -EINVAL;
+		v[2] = v[3] = 0.0;
+		c = 0;
+		snd_config_for_each(j, jnext, row) {
+			if (c == 4 ||
+			    snd_config_get_ireal(snd_config_iterator_entry(j),
+						 &v[c]) < 0)
+				return -EINVAL;
+			c++;
+		}
+		if (c < 2 || v[0] <= 0.0 || v[1] <= v[0] || v[2] < 0.0 ||
+		    v[3] < 0.0 || v[3] > INT32_MAX)
+			return -EINVAL;
+		band[n].fmin = v[0];
+		band[n].fmax = v[1];
+		band[n].threshold = v[2];
+		band[n].history = (int32_t)v[3];
+		n++;
+	}
+	if (n == 0)
+		return -EINVAL;
+	*nbands = n;
+	return 0;
+}
+
+/* downmix [ [ g0 g1 .. ] [ .. ] ]: a row of gains, one per input
+ * channel, for each of the two analysis channels (gbdserver takes
+ * stereo only) */
+static int gbd_parse_downmix(snd_config_t *conf, long channels,
+			     gbd_mix_t *mx)
+{
+	float gains[GBD_MIX_OUT_MAX * GBD_CHANNELS_MAX];
+	snd_config_iterator_t i, next, j, jnext;
+	unsigned int rows = 0;
+	long c;
+	double v;
+
+	if (snd_config_get_type(conf) != SND_CONFIG_TYPE_COMPOUND)
+		return -EINVAL;
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *row = snd_config_iterator_entry(i);
+
+		if (rows == 2 ||
+		    snd_config_get_type(row) != SND_CONFIG_TYPE_COMPOUND)
+			return -EINVAL;
+		c = 0;
+		snd_config_for_each(j, jnext, row) {
+			if (c == channels ||
+			    snd_config_get_ireal(snd_config_iterator_entry(j),
+						 &v) < 0)
+				return -EINVAL;
+			gains[rows * channels + c++] = v;
+		}
+		if (c != channels)
+			return -EINVAL;
+		rows++;
+	}
+	if (rows != 2)
+		return -EINVAL;
+	return gbd_mix_init(mx, channels, rows, gains);
+}
+
+/*
+ * func: _snd_pcm_gbdclient_open
+ * desc: gbdclient options (e.g. .asoundrc pcm block)
+ *         slave             alsa pcm slave (mandatory)
+ *         ipaddr, port      gbdserver host and port, or a unix socket
+ *                           path and no port (mandatory)
+ *         channels          1..8; streams other than stereo are
+ *                           downmixed to stereo for analysis, playback
+ *                           keeps every channel (2)
+ *         downmix           analysis downmix matrix instead of the
+ *                           default one: two rows of one gain per
+ *                           input channel, e.g. for 2.1
+ *                           [ [ 1 0 0.5 ] [ 0 1 0.5 ] ]
+ *         lfe_channel       input channel carrying the LFE, -1 for none
+ *                           (2 for 2.1, 5 for 5.1/6.1/7.1, else -1)
+ *         lfe_gain          share of the LFE in the default downmix (0.707)
+ *         lfe_forward       also send the LFE alone as an extra analysis
+ *                           channel; needs protocol 2 and a gbdserver
+ *                           that takes more than two channels, others
+ *                           get stereo (no)
+ *         async             queue periods for a sender thread instead of
+ *                           writing to the socket on the alsa thread;
+ *                           not with transport shm, whose ring the alsa
+ *                           thread fills directly (no)
+ *         async_latency     ms the sender may hold periods to batch them (10)
+ *         async_buffer      ms of audio the async or shm ring holds (500)
+ *         trace             record the capture and send of every message
+ *                           (pcm mode) in a POSIX SHM buffer, for
+ *                           gbd-trace (no)
+ *         metrics           unix socket path to serve the counters on,
+ *                           in Prometheus text format, e.g. for
+ *                           curl --unix-socket <path> http://gbd/; left
+ *                           to the instance already serving on it (none)
+ *         shed_latency      ms of audio queued on the tcp connection past
+ *                           which the gbdserver is taken to be behind
+ *                           realtime and periods are skipped, 0 to
+ *                           never skip for that (250)
+ *         encoding          wire encoding offered to the gbdserver: float,
+ *                           s16 or rice (delta + Rice coded s16); a
+ *                           gbdserver that leaves the offer unanswered
+ *                           for 0.5 s gets float (float)
+ *         transport         tcp, udp to send the audio as sequenced
+ *                           datagrams that are dropped rather than
+ *                           retransmitted when lost, or shm to share a
+ *                           ring of periods with a gbdserver on this
+ *                           host; udp and shm need a gbdserver that
+ *                           takes them (tcp)
+ *         mode              pcm, or features to send per-hop band energies
+ *                           instead of the audio; needs protocol 2, a
+ *                           v1 gbdserver gets pcm (pcm)
+ *         feature_bands     bands per feature vector, 4..32 (24)
+ *         feature_hop       ms between feature vectors (5)
+ *         feature_window    frames each vector is computed over, a
+ *                           power of two 16..32768 and at least a hop
+ *                           long, e.g. 1024 with a 3 ms hop for fine
+ *                           onset timing at a good frequency resolution
+ *                           (the smallest power of two >= 2 hops)
+ *         feature_band_list bands to send in place of the feature_bands
+ *                           log spaced ones, up to 32 rows of [ fmin fmax
+ *                           threshold history ] (Hz below half the
+ *                           rate, ratio, vectors),
+ *                           e.g. [ [ 30 60 ] [ 60 120 1.4 ] [ 6000 16000 ] ]
+ *                           for sub-kick, kick and hi-hat; threshold and
+ *                           history are for the gbdserver's detectors,
+ *                           0 or left out for their defaults (none)
+ *         feature_engine    fft, or iir for a filterbank run sample by
+ *                           sample, whose onsets show within a few ms
+ *                           instead of after a window; no feature_window
+ *                           then (fft)
+ *         stream            name of the beat count segment the gbdserver
+ *                           publishes this stream in, [A-Za-z0-9_-],
+ *                           e.g. kitchen for /dev/shm/gbd-kitchen; needs
+ *                           protocol 2 and a gbdserver newer than the
+ *                           shipped one, which publishes every stream
+ *                           in /dev/shm/gbd (none, i.e. /dev/shm/gbd)
+ *         protocol          1, or 2 to set the stream up in one round
+ *                           trip with a gbdserver that knows it; one
+ *                           that does not costs the first open a 1 s
+ *                           wait, then gets 1 (1)
+ */
+SND_PCM_PLUGIN_DEFINE_FUNC(gbdclient)
+{
+	snd_config_iterator_t i, next;
+	snd_pcm_gbdclient_t *gbd;
+	snd_config_t *sconf = NULL;
+	const char *ipaddr = NULL;
+	const char *port = NULL;
+	long channels = 2;
+	snd_config_t *downmix = NULL;
+	long lfe_channel = -2;
+	double lfe_gain = GBD_LFE_GAIN;
+	int lfe_forward = 0;
+	gbd_mix_t mixer;
+	int mixing;
+	int async = 0;
+	int trace = 0;
+	long async_latency = GBD_ASYNC_LATENCY;
+	long async_buffer = GBD_ASYNC_BUFFER;
+	long shed_latency = GBD_SHED_LATENCY;
+	int encoding = GBD_ENCODING_FLOAT;
+	int transport = GBD_TRANSPORT_TCP;
+	int gbd_mode = GBD_MODE_PCM;
+	long feature_bands = GBD_FEATURE_BANDS;
+	long feature_hop = GBD_FEATURE_HOP;
+	long feature_window = 0;
+	int feature_engine = GBD_FEATURE_FFT;
+	snd_config_t *band_list = NULL;
+	long proto = 1;
+	const char *stream_name = "";
+	const char *metrics = NULL;
+	const char *str;
+	int err;
+
+	/* Parse config file (e.g. .asoundrc) options */
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+
+		if (strcmp(id, "comment") == 0 || strcmp(id, "type") == 0
+		    || strcmp(id, "hint") == 0)
+			continue;
+
+		if (strcmp(id, "slave") == 0) {
+			sconf = n;
+			continue;
+		}
+
+		if (strcmp(id, "ipaddr") == 0) {
+			snd_config_get_string(n, &ipaddr);
+			continue;
+		}
+
+		if (strcmp(id, "port") == 0) {
+			snd_config_get_string(n, &port);
+			continue;
+		}
+
+		if (strcmp(id, "channels") == 0) {
+			snd_config_get_integer(n, &channels);
+			if (channels < 1 || channels > GBD_CHANNELS_MAX) {
+				SNDERR("channels must be 1..%d", GBD_CHANNELS_MAX);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "downmix") == 0) {
+			downmix = n;
+			continue;
+		}
+
+		if (strcmp(id, "lfe_channel") == 0) {
+			snd_config_get_integer(n, &lfe_channel);
+			if (lfe_channel < -1 || lfe_channel >= GBD_CHANNELS_MAX) {
+				SNDERR("Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "lfe_gain") == 0) {
+			if (snd_config_get_ireal(n, &lfe_gain) < 0 ||
+			    lfe_gain < 0.0 || lfe_gain > 1.0) {
+				SNDERR("lfe_gain must be 0..1");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "lfe_forward") == 0) {
+			lfe_forward = snd_config_get_bool(n);
+			if (lfe_forward < 0) {
+				SNDERR("Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "trace") == 0) {
+			trace = snd_config_get_bool(n);
+			if (trace < 0) {
+				SNDERR("Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "async") == 0) {
+			async = snd_config_get_bool(n);
+			if (async < 0) {
+				SNDERR("Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "async_latency") == 0) {
+			snd_config_get_integer(n, &async_latency);
+			if (async_latency < 0 || async_latency > 1000) {
+				SNDERR("async_latency must be 0..1000 ms");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "async_buffer") == 0) {
+			snd_config_get_integer(n, &async_buffer);
+			if (async_buffer < 10 || async_buffer > 10000) {
+				SNDERR("async_buffer must be 10..10000 ms");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "shed_latency") == 0) {
+			snd_config_get_integer(n, &shed_latency);
+			if (shed_latency < 0 || shed_latency > 10000) {
+				SNDERR("shed_latency must be 0..10000 ms");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "encoding") == 0) {
+			if (snd_config_get_string(n, &str) < 0)
+				str = "";
+			if (strcmp(str, "float") == 0)
+				encoding = GBD_ENCODING_FLOAT;
+			else if (strcmp(str, "s16") == 0)
+				encoding = GBD_ENCODING_S16;
+			else if (strcmp(str, "rice") == 0)
+				encoding = GBD_ENCODING_RICE;
+			else {
+				SNDERR("encoding must be float, s16 or rice");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "transport") == 0) {
+			if (snd_config_get_string(n, &str) < 0)
+				str = "";
+			if (strcmp(str, "tcp") == 0)
+				transport = GBD_TRANSPORT_TCP;
+			else if (strcmp(str, "udp") == 0)
+				transport = GBD_TRANSPORT_UDP;
+			else if (strcmp(str, "shm") == 0)
+				transport = GBD_TRANSPORT_SHM;
+			else {
+				SNDERR("transport must be tcp, udp or shm");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "mode") == 0) {
+			if (snd_config_get_string(n, &str) < 0)
+				str = "";
+			if (strcmp(str, "pcm") == 0)
+				gbd_mode = GBD_MODE_PCM;
+			else if (strcmp(str, "features") == 0)
+				gbd_mode = GBD_MODE_FEATURES;
+			else {
+				SNDERR("mode must be pcm or features");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "feature_bands") == 0) {
+			snd_config_get_integer(n, &feature_bands);
+			if (feature_bands < GBD_FEATURE_BANDS_MIN ||
+			    feature_bands > GBD_FEATURE_BANDS_MAX) {
+				SNDERR("feature_bands must be %d..%d",
+				       GBD_FEATURE_BANDS_MIN, GBD_FEATURE_BANDS_MAX);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "feature_hop") == 0) {
+			snd_config_get_integer(n, &feature_hop);
+			if (feature_hop < 1 || feature_hop > 50) {
+				SNDERR("feature_hop must be 1..50 ms");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "feature_window") == 0) {
+			snd_config_get_integer(n, &feature_window);
+			if (feature_window < 16 ||
+			    feature_window > GBD_FEATURE_WINDOW_MAX ||
+			    (feature_window & (feature_window - 1))) {
+				SNDERR("feature_window must be a power of two "
+				       "16..%d frames", GBD_FEATURE_WINDOW_MAX);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "feature_band_list") == 0) {
+			band_list = n;
+			continue;
+		}
+
+		if (strcmp(id, "feature_engine") == 0) {
+			if (snd_config_get_string(n, &str) < 0)
+				str = "";
+			if (strcmp(str, "fft") == 0)
+				feature_engine = GBD_FEATURE_FFT;
+			else if (strcmp(str, "iir") == 0)
+				feature_engine = GBD_FEATURE_IIR;
+			else {
+				SNDERR("feature_engine must be fft or iir");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "stream") == 0) {
+			if (snd_config_get_string(n, &stream_name) < 0 ||
+			    !gbd_stream_name_ok(stream_name)) {
+				SNDERR("stream must be up to %d of [A-Za-z0-9_-]",
+				       GBD_STREAM_NAME_MAX - 1);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "metrics") == 0) {
+			if (snd_config_get_string(n, &metrics) < 0 ||
+			    !*metrics) {
+				SNDERR("metrics must be a socket path");
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strcmp(id, "protocol") == 0) {
+			snd_config_get_integer(n, &proto);
+			if (proto < 1 || proto > GBD_PROTO_VERSION) {
+				SNDERR("protocol must be 1..%d", GBD_PROTO_VERSION);
+				return -EINVAL;
+			}
+			continue;
+		}
+		SNDERR("Unknown field %s", id);
+		return -EINVAL;
+	}
+
+	/* Make sure an ip address was specified */
+	if (ipaddr && ipaddr[0] == '/')
+		port = "";
+	if (!ipaddr || !port) {
+		SNDERR("Missing \"ipaddr\" or \"port\"\n");
+		return -EINVAL;
+	}
+
+	if (transport == GBD_TRANSPORT_UDP && ipaddr[0] == '/') {
+		SNDERR("udp transport needs an ip address");
+		return -EINVAL;
+	}
+
+	/* the shm ring already takes the periods off the alsa thread, a
+	 * second ring and thread would only copy them once more */
+	if (transport == GBD_TRANSPORT_SHM)
+		async = 0;
+
+	if (lfe_forward && proto < GBD_PROTO_VERSION) {
+		SNDERR("lfe_forward needs protocol %d", GBD_PROTO_VERSION);
+		return -EINVAL;
+	}
+
+	if (gbd_mode == GBD_MODE_FEATURES && proto < GBD_PROTO_VERSION) {
+		SNDERR("mode features needs protocol %d", GBD_PROTO_VERSION);
+		return -EINVAL;
+	}
+
+	/* Analysis stream: anything but plain stereo goes through the
+	 * downmix */
+	if (lfe_channel == -2)
+		lfe_channel = gbd_mix_lfe(channels);
+	if (lfe_channel >= channels) {
+		SNDERR("lfe_channel must be below channels");
+		return -EINVAL;
+	}
+	mixing = downmix || channels != 2 || lfe_forward;
+	if (downmix && gbd_parse_downmix(downmix, channels, &mixer) < 0) {
+		SNDERR("downmix must hold two rows of %ld gains",
+		       channels);
+		return -EINVAL;
+	}
+	if (!downmix)
+		gbd_mix_default(&mixer, channels, lfe_channel, lfe_gain);
+	if (lfe_forward && gbd_mix_add_lfe(&mixer, lfe_channel) < 0) {
+		SNDERR("lfe_forward needs an lfe_channel");
+		return -EINVAL;
+	}
+
+	/* Make sure an ALSA slave PCM device was specified */
+	if (!sconf) {
+		SNDERR("Must include slave configuration with gbdclient plugin");
+		return -EINVAL;
+	}
+
+	if (feature_engine == GBD_FEATURE_IIR && feature_window) {
+		SNDERR("feature_window does not apply to the iir feature_engine");
+		return -EINVAL;
+	}
+
+	/* Alloc local GBD object */
+	gbd = calloc(1, sizeof(*gbd));
+	if (gbd == NULL)
+		return -ENOMEM;
+	gbd->fd = -1;
+	gbd->udp_fd = -1;
+	gbd->metrics.fd = -1;
+	if (sem_init(&gbd->link_wakeup, 0, 0) < 0) {
+		err = -errno;
+		free(gbd);
+		return err;
+	}
+	pthread_mutex_init(&gbd->link_lock, NULL);
+	/* gbd->async, set once this succeeded, tells error whether there
+	 * is a wakeup to destroy */
+	if (async && sem_init(&gbd->wakeup, 0, 0) < 0) {
+		err = -errno;
+		goto error;
+	}
+
+	/* Initialize local GDB object members */
+	gbd->ext.version = SND_PCM_EXTPLUG_VERSION;
+	gbd->ext.name = "gbdclient";
+	gbd->ext.callback = &pcm_gbdclient_callback;
+	gbd->ext.private_data = gbd;
+	gbd->channels = channels;
+	gbd->mixing = mixing;
+	gbd->lfe_forward = lfe_forward;
+	gbd->mixer = mixer;
+	gbd->achannels = mixing ? (int)mixer.out : channels;
+	gbd->async = async;
+	gbd->async_latency = async_latency;
+	gbd->async_buffer = async_buffer;
+	gbd->shed_latency = shed_latency;
+	gbd->encoding = encoding;
+	gbd->transport = transport;
+	gbd->mode = gbd_mode;
+	gbd->feature_bands = feature_bands;
+	gbd->feature_hop = feature_hop;
+	gbd->feature_window = feature_window;
+	gbd->feature_engine = feature_engine;
+	if (band_list && gbd_parse_band_list(band_list, gbd->band_list,
+					     &gbd->band_list_len) < 0) {
+		SNDERR("Invalid feature_band_list");
+		err = -EINVAL;
+		goto error;
+	}
+	gbd->proto = proto;
+	strcpy(gbd->stream, stream_name);
+	gbd->ipaddr = strdup(ipaddr);
+	gbd->port = strdup(port);
+	if (!gbd->ipaddr || !gbd->port) {
+		err = -ENOMEM;
+		goto error;
+	}
+
+	/* Load gbd server-side DSP LADSPA library module (v1; v2 does it
+	 * with the handshake); without a gbdserver, playback starts
+	 * anyway and the link thread keeps trying in the background */
+	gbd->fd = gbd_connect(ipaddr, port, SOCK_STREAM);
+	if (gbd->fd < 0) {
+		SNDERR("Failed to connect with gbdserver, retrying in the background");
+	} else {
+		gbd_sockopts(gbd, gbd->fd);
+		if (gbd_hello(gbd) < 0)
+			SNDERR("Failed to initialize gbd LADSPA module");
+		else
+			atomic_store(&gbd->link, GBD_LINK_UP);
+	}
+
+	/* Create gbdclient external PCM filter plugin */
+	err = snd_pcm_extplug_create(&gbd->ext, name, root, sconf, stream, mode);
+	if (err < 0)
+		goto error;
+
+	atomic_store(&gbd->link_running, 1);
+	if (pthread_create(&gbd->linker, NULL, gbd_link_thread, gbd)) {
+		atomic_store(&gbd->link_running, 0);
+		snd_pcm_extplug_delete(&gbd->ext);
+		return -EAGAIN;
+	}
+
+	/* diagnostics only: the stream plays on without them */
+	if (metrics) {
+		err = gbd_metrics_start(&gbd->metrics, metrics,
+					gbd_metrics_write, gbd);
+		if (err < 0)
+			SNDERR("WARNING: gbd metrics on %s: %s", metrics,
+			       strerror(-err));
+	}
+	if (trace) {
+		gbd->trace = gbd_trace_open("gbdclient", gbd->stream);
+		if (!gbd->trace)
+			SNDERR("WARNING: gbd trace buffer: %s", strerror(errno));
+	}
+
+	/* Set external PCM filter plugin constraints */
+	snd_pcm_extplug_set_param_minmax(&gbd->ext,
+					 SND_PCM_EXTPLUG_HW_CHANNELS,
+					 gbd->channels,
+					 gbd->channels);
+	snd_pcm_extplug_set_slave_param(&gbd->ext,
+					SND_PCM_EXTPLUG_HW_CHANNELS,
+					gbd->channels);
+	/* the slave format follows, i.e. no conversion either side */
+	snd_pcm_extplug_set_param_list(&gbd->ext,
+				       SND_PCM_EXTPLUG_HW_FORMAT,
+				       sizeof(gbd_formats) / sizeof(gbd_formats[0]),
+				       gbd_formats);
 
 	*pcmp = gbd->ext.pcm;
 	return 0;
+
+error:
+	/* before snd_pcm_extplug_create() took gbd over, i.e. no thread
+	 * and nothing of gbdclient_init() yet */
+	if (gbd->fd >= 0)
+		close(gbd->fd);
+	free((char *)gbd->ipaddr);
+	free((char *)gbd->port);
+	if (gbd->async)
+		sem_destroy(&gbd->wakeup);
+	sem_destroy(&gbd->link_wakeup);
+	pthread_mutex_destroy(&gbd->link_lock);
+	free(gbd);
+	return err;
 }
 SND_PCM_PLUGIN_SYMBOL(gbdclient);
@@ -8,6 +8,12 @@
  * Compile with:
  *
  * 	"gcc -Wall -O2 gbd-gl.c -o gbd-gl -lglut -lGLU -lrt -lm"
+ *
+ * Run with the name of a stream, if not the default one, e.g.
+ *
+ * 	"./gbd-gl kitchen"
+ *
+ * (named streams need a gbdserver newer than the shipped one, see gbd.h)
  
  * This program is distributed in the hope that it will be useful,
  * but WITHOUT ANY WARRANTY; without even the implied warranty of
@@ -306,10 +312,13 @@ int main(int argc, char **argv)
 {
 	void *lmap;
 	glutInit(&argc, argv);
-	const char *filename = "gbd";
+	char filename[sizeof(GBD_STREAM_PREFIX) + GBD_STREAM_NAME_MAX];
 
 	if (argv[1])
-		filename = argv[1];
+		snprintf(filename, sizeof(filename), GBD_STREAM_PREFIX "%s",
+			 argv[1]);
+	else
+		snprintf(filename, sizeof(filename), GBD_BEAT_COUNT_FILE);
 
 	if(!(lmap = shm_init(filename)))
 		exit(EXIT_FAILURE);
@@ -2,6 +2,12 @@
  * desc : illustrates GBD Linux POSIX SHM IPC for beat counts
  *
  * build: gcc -Wall -O2 gbd-text-display.c -o gbd-text-display -lrt
+ * usage: gbd-text-display [stream]   counts of the named stream, e.g.
+ *                                    kitchen
+ *        gbd-text-display -l         streams the gbdserver analyses
+ *
+ * Named streams and the stream registry need a gbdserver newer than the
+ * shipped one (see gbd.h); with that one, run without arguments.
  * 
  * This program is distributed in the hope that it will be useful,
  * but WITHOUT ANY WARRANTY; without even the implied warranty of
@@ -51,10 +57,49 @@ exit:
 }
 
 
-int main(void)
+static int list_streams(void)
 {
+	struct gbd_stream_registry *reg;
+	int fd, i;
+
+	/* only the gbdserver creates it, see gbd.h */
+	fd = shm_open(GBD_STREAM_REGISTRY_FILE, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "No GBD stream registry (%s), it needs a newer "
+			"gbdserver!\n", strerror(errno));
+		return -1;
+	}
+	reg = mmap(0, sizeof(*reg), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (reg == MAP_FAILED) {
+		fprintf(stderr, "mmap(2): %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < reg->nstreams && i < GBD_STREAMS_MAX; i++) {
+		if (!reg->stream[i].rate)
+			continue;
+		printf("%-*.*s %6d Hz %d ch\n", GBD_STREAM_NAME_MAX,
+		       GBD_STREAM_NAME_MAX - 1,
+		       reg->stream[i].name[0] ? reg->stream[i].name : "(default)",
+		       reg->stream[i].rate, reg->stream[i].channels);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char filename[sizeof(GBD_STREAM_PREFIX) + GBD_STREAM_NAME_MAX];
 	int *beat_cnt_map;
-	beat_cnt_map =  (int *)shm_init(GBD_BEAT_COUNT_FILE);
+
+	snprintf(filename, sizeof(filename), GBD_BEAT_COUNT_FILE);
+	if (argc > 1 && strcmp(argv[1], "-l") == 0)
+		return list_streams();
+	if (argc > 1)
+		snprintf(filename, sizeof(filename), GBD_STREAM_PREFIX "%s",
+			 argv[1]);
+
+	beat_cnt_map =  (int *)shm_init(filename);
 	if (!beat_cnt_map) {
 		fprintf(stderr, "Could not open GBD IPC file!\n");
 		return -1;
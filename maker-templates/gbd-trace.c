@@ -0,0 +1,199 @@
+/* file : gbd-trace.c
+ * desc : dumps the GBD latency trace buffers (see gbd_trace.h) of the
+ *        processes on this host as Chrome/Perfetto trace JSON
+ *
+ * build: gcc -Wall -O2 gbd-trace.c -o gbd-trace -lrt
+ * usage: gbd-trace > trace.json   then load it in ui.perfetto.dev
+ *                                 or chrome://tracing
+ *
+ * Every stage of a period is an instant on its process, on a track
+ * named after the stage; from one stage of a period to the next there
+ * is a slice, e.g. "send > receive", whose length is that latency.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "gbd_trace.h"
+
+#define MAX_BUFFERS 64
+#define MAX_GAP_NS 10000000000LL	/* stages further apart: seq reused */
+
+static const char *stage_name[GBD_TRACE_STAGES] = {
+	"capture", "send", "receive", "dsp start", "dsp end", "publish",
+	"observe", "output",
+};
+
+struct event {
+	gbd_trace_event_t ev;
+	gbd_trace_t *buf;
+};
+
+static gbd_trace_t *buffers[MAX_BUFFERS];
+static int nbuffers;
+static struct event *events;
+static size_t nevents;
+
+static gbd_trace_t *trace_map(const char *name)
+{
+	char path[sizeof(GBD_TRACE_PREFIX) + 256];
+	gbd_trace_t *t;
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), "/%s", name);
+	fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "shm_open(3) %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(gbd_trace_t)) {
+		close(fd);
+		return NULL;
+	}
+	t = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (t == MAP_FAILED)
+		return NULL;
+	if (t->magic != GBD_TRACE_MAGIC || !t->nevents ||
+	    (t->nevents & (t->nevents - 1)) ||
+	    gbd_trace_bytes(t->nevents) > (size_t)st.st_size) {
+		munmap(t, st.st_size);
+		return NULL;
+	}
+	return t;
+}
+
+static int collect(gbd_trace_t *t)
+{
+	uint32_t head = atomic_load(&t->head);
+	uint32_t pos = head > t->nevents ? head - t->nevents : 0;
+	struct event *e;
+
+	e = realloc(events, (nevents + (head - pos)) * sizeof(*events));
+	if (!e && head != pos)
+		return -1;
+	events = e;
+	for (; pos != head; pos++) {
+		if (!gbd_trace_read(t, pos, &events[nevents].ev))
+			continue;
+		if (events[nevents].ev.stage < 0 ||
+		    events[nevents].ev.stage >= GBD_TRACE_STAGES)
+			continue;
+		events[nevents++].buf = t;
+	}
+	return 0;
+}
+
+/* periods: by stream and seq, then in time order */
+static int cmp_event(const void *a, const void *b)
+{
+	const struct event *x = a, *y = b;
+	int c = strcmp(x->buf->stream, y->buf->stream);
+
+	if (c)
+		return c;
+	if (x->ev.seq != y->ev.seq)
+		return x->ev.seq < y->ev.seq ? -1 : 1;
+	if (x->ev.ts != y->ev.ts)
+		return x->ev.ts < y->ev.ts ? -1 : 1;
+	return x->ev.stage - y->ev.stage;
+}
+
+static int same_period(const struct event *x, const struct event *y)
+{
+	return x->ev.seq == y->ev.seq &&
+	    !strcmp(x->buf->stream, y->buf->stream) &&
+	    y->ev.ts - x->ev.ts < MAX_GAP_NS && y->ev.stage > x->ev.stage;
+}
+
+static void dump(void)
+{
+	const char *sep = "";
+	size_t i;
+	int b, s;
+
+	printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (b = 0; b < nbuffers; b++) {
+		printf("%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+		       "\"args\":{\"name\":\"%s%s%s%s\"}}", sep,
+		       buffers[b]->pid, buffers[b]->name,
+		       buffers[b]->stream[0] ? " (" : "", buffers[b]->stream,
+		       buffers[b]->stream[0] ? ")" : "");
+		sep = ",\n";
+		for (s = 0; s < GBD_TRACE_STAGES; s++)
+			printf("%s{\"name\":\"thread_name\",\"ph\":\"M\","
+			       "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			       sep, buffers[b]->pid, s, stage_name[s]);
+	}
+
+	for (i = 0; i < nevents; i++) {
+		struct event *e = &events[i];
+
+		printf("%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,"
+		       "\"tid\":%d,\"ts\":%.3f,\"args\":{\"seq\":%u}}", sep,
+		       stage_name[e->ev.stage], e->buf->pid, e->ev.stage,
+		       e->ev.ts / 1e3, e->ev.seq);
+		if (i == 0 || !same_period(e - 1, e))
+			continue;
+		printf("%s{\"name\":\"%s > %s\",\"ph\":\"X\",\"pid\":%d,"
+		       "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+		       "\"args\":{\"seq\":%u}}", sep,
+		       stage_name[e[-1].ev.stage], stage_name[e->ev.stage],
+		       e->buf->pid, e->ev.stage, e[-1].ev.ts / 1e3,
+		       (e->ev.ts - e[-1].ev.ts) / 1e3, e->ev.seq);
+	}
+	printf("\n]}\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct dirent *d;
+	gbd_trace_t *t;
+	DIR *dir;
+	int b;
+
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s > trace.json\n", argv[0]);
+		return -1;
+	}
+
+	dir = opendir("/dev/shm");
+	if (!dir) {
+		fprintf(stderr, "opendir(3) /dev/shm: %s\n", strerror(errno));
+		return -1;
+	}
+	while ((d = readdir(dir)) && nbuffers < MAX_BUFFERS) {
+		if (strncmp(d->d_name, GBD_TRACE_PREFIX,
+			    strlen(GBD_TRACE_PREFIX)))
+			continue;
+		t = trace_map(d->d_name);
+		if (t)
+			buffers[nbuffers++] = t;
+	}
+	closedir(dir);
+	if (!nbuffers) {
+		fprintf(stderr, "No GBD trace buffers, is tracing on?\n");
+		return -1;
+	}
+
+	for (b = 0; b < nbuffers; b++)
+		if (collect(buffers[b]) < 0) {
+			fprintf(stderr, "Out of memory!\n");
+			return -1;
+		}
+	qsort(events, nevents, sizeof(*events), cmp_event);
+	dump();
+	return 0;
+}
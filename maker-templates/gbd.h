@@ -18,8 +18,16 @@
 #define CYMBALS  2
 #define AVG_ENERGY_L_CHANNEL 3
 #define AVG_ENERGY_R_CHANNEL 4
-#define RESERVED0 5
-#define RESERVED1 6 
+/* us from a count change until its audio is heard, as reported by
+ * gbdclient (0 if unknown); delay effects by this much to land them
+ * on the acoustic moment */
+#define OUTPUT_DELAY_US 5
+/* seq of the period whose analysis the counts last changed with, see
+ * gbd_trace.h; published by the gbdserver while tracing */
+#define TRACE_SEQ 6
+/* the names of these slots before, for existing sketches */
+#define RESERVED0 OUTPUT_DELAY_US
+#define RESERVED1 TRACE_SEQ
 #define RESERVED2 7
 #define RESERVED3 8
 #define BASSLINE 9
@@ -27,4 +35,37 @@
 /* Number of array elements */
 #define GBD_BEAT_COUNT_BUF_SIZE 10
 
+/* Counts of the bands of a gbdclient feature_band_list, in list order,
+ * when the gbdserver took the list; the segment is then
+ * GBD_BEAT_COUNT_BUF_SIZE + GBD_BANDS_MAX ints long */
+#define GBD_BANDS_MAX 32
+#define BAND_COUNT(b) (GBD_BEAT_COUNT_BUF_SIZE + (b))
+
+/* Per-stream segments: the counts of a gbdclient with stream "name"
+ * in its .asoundrc block are published in GBD_STREAM_PREFIX "name"
+ * (same layout as above); unnamed streams use GBD_BEAT_COUNT_FILE.
+ * Names are made of [A-Za-z0-9_-] only, and the programs here take
+ * them bare (kitchen, not gbd-kitchen). Only a gbdserver newer than
+ * the shipped one, which speaks gbdclient protocol 2, writes these
+ * segments and the registry below; the shipped one publishes every
+ * stream in GBD_BEAT_COUNT_FILE. */
+#define GBD_STREAM_PREFIX "gbd-"
+#define GBD_STREAM_NAME_MAX 32
+
+/* Registry of the streams the gbdserver is analysing, in POSIX SHM;
+ * a slot is in use while its rate is non-zero */
+#define GBD_STREAM_REGISTRY_FILE "gbd.streams"
+#define GBD_STREAMS_MAX 64
+
+struct gbd_stream_info {
+	char name[GBD_STREAM_NAME_MAX];	/* "" for GBD_BEAT_COUNT_FILE */
+	int rate;
+	int channels;
+};
+
+struct gbd_stream_registry {
+	int nstreams;			/* slots to scan */
+	struct gbd_stream_info stream[GBD_STREAMS_MAX];
+};
+
 #endif /* __GBD_H__ */
@@ -0,0 +1 @@
+../gbdclient/gbd_trace.h
\ No newline at end of file
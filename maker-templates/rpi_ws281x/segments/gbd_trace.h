@@ -0,0 +1 @@
+../../gbd_trace.h
\ No newline at end of file
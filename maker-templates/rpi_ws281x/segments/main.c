@@ -29,6 +29,7 @@
 
 static char VERSION[] = "XX.YY.ZZ";
 
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +42,9 @@ static char VERSION[] = "XX.YY.ZZ";
 #include <signal.h>
 #include <stdarg.h>
 #include <getopt.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
 
 #include "clk.h"
 #include "gpio.h"
@@ -91,6 +95,14 @@ ws2811_t ledstring = {
 };
 
 static uint8_t running = 1;
+static const char *stream;
+
+/* realtime setup, see setup_realtime() */
+static cpu_set_t cpus;
+static int rtprio;
+static int lock_memory;
+static int show_stats;
+static int tracing;
 
 void matrix_render(int height, uint32_t color)
 {
@@ -125,6 +137,33 @@ static void setup_handlers(void)
 	sigaction(SIGTERM, &sa, NULL);
 }
 
+/* cpu list, e.g. "0-2" or "1,3" */
+static int parse_cpus(const char *list, cpu_set_t *set)
+{
+	char *end;
+	long lo, hi;
+
+	CPU_ZERO(set);
+	do {
+		lo = hi = strtol(list, &end, 10);
+		if (end == list)
+			return -1;
+		if (*end == '-') {
+			list = end + 1;
+			hi = strtol(list, &end, 10);
+			if (end == list)
+				return -1;
+		}
+		if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+			return -1;
+		for (; lo <= hi; lo++)
+			CPU_SET(lo, set);
+		list = end + 1;
+	} while (*end == ',');
+
+	return *end ? -1 : 0;
+}
+
 void parseargs(int argc, char **argv, ws2811_t * ws2811)
 {
 	int index;
@@ -140,13 +179,19 @@ void parseargs(int argc, char **argv, ws2811_t * ws2811)
 		{"height", required_argument, 0, 'y'},
 		{"width", required_argument, 0, 'x'},
 		{"version", no_argument, 0, 'v'},
+		{"stream", required_argument, 0, 'n'},
+		{"cpus", required_argument, 0, 'a'},
+		{"rtprio", required_argument, 0, 'r'},
+		{"mlock", no_argument, 0, 'm'},
+		{"stats", no_argument, 0, 'S'},
+		{"trace", no_argument, 0, 't'},
 		{0, 0, 0, 0}
 	};
 
 	while (1) {
 
 		index = 0;
-		c = getopt_long(argc, argv, "cd:g:his:vx:y:", longopts, &index);
+		c = getopt_long(argc, argv, "a:cd:g:himn:r:s:Stvx:y:", longopts, &index);
 
 		if (c == -1)
 			break;
@@ -168,6 +213,16 @@ void parseargs(int argc, char **argv, ws2811_t * ws2811)
 				"                 If omitted, default is 18 (PWM0)\n"
 				"-i (--invert)  - invert pin output (pulse LOW)\n"
 				"-c (--clear)   - clear matrix on exit.\n"
+				"-n (--stream)  - gbdclient stream to follow, e.g.\n"
+				"                 kitchen (needs a newer gbdserver)\n"
+				"-a (--cpus)    - cpus to run on, e.g. 0-2 or 1,3\n"
+				"                 (keep off the gbdserver dsp core)\n"
+				"-r (--rtprio)  - SCHED_FIFO priority (1-99)\n"
+				"-m (--mlock)   - lock memory, no page faults\n"
+				"-S (--stats)   - page faults and involuntary context\n"
+				"                 switches per second, every 10s\n"
+				"-t (--trace)   - record beats seen and frames out\n"
+				"                 for gbd-trace\n"
 				"-v (--version) - version information\n",
 				argv[0]);
 			exit(-1);
@@ -204,6 +259,38 @@ void parseargs(int argc, char **argv, ws2811_t * ws2811)
 			clear_on_exit = 1;
 			break;
 
+		case 'n':
+			stream = optarg;
+			break;
+
+		case 'a':
+			if (parse_cpus(optarg, &cpus) < 0) {
+				printf("invalid cpus %s\n", optarg);
+				exit(-1);
+			}
+			break;
+
+		case 'r':
+			rtprio = atoi(optarg);
+			if (rtprio < sched_get_priority_min(SCHED_FIFO) ||
+			    rtprio > sched_get_priority_max(SCHED_FIFO)) {
+				printf("invalid rtprio %d\n", rtprio);
+				exit(-1);
+			}
+			break;
+
+		case 'm':
+			lock_memory = 1;
+			break;
+
+		case 'S':
+			show_stats = 1;
+			break;
+
+		case 't':
+			tracing = 1;
+			break;
+
 		case 'd':
 			if (optarg) {
 				int dma = atoi(optarg);
@@ -297,6 +384,7 @@ void parseargs(int argc, char **argv, ws2811_t * ws2811)
 
 #include <errno.h>
 #include "gbd.h"
+#include "gbd_trace.h"
 
 static void *shm_init(const char *filename)
 {
@@ -329,6 +417,66 @@ exit:
 	return NULL;
 }
 
+/*
+ * The strip is refreshed from a tight loop, so a page fault or being
+ * preempted shows as a late frame. Pinning the process away from the
+ * core the gbdserver analyses on keeps the two from delaying each
+ * other. Call once the strip is set up, so its buffers are locked too.
+ */
+static void setup_realtime(void)
+{
+	struct sched_param sp = {
+		.sched_priority = rtprio,
+	};
+
+	if (CPU_COUNT(&cpus) &&
+	    sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+		fprintf(stderr, "sched_setaffinity(2): %s\n", strerror(errno));
+
+	if (rtprio && sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+		fprintf(stderr, "sched_setscheduler(2): %s\n", strerror(errno));
+
+	if (lock_memory) {
+		volatile char stack[64 * 1024];
+		size_t i;
+
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			fprintf(stderr, "mlockall(2): %s\n", strerror(errno));
+			return;
+		}
+		/* fault in the stack the loop will use */
+		for (i = 0; i < sizeof(stack); i += 4096)
+			stack[i] = 0;
+	}
+}
+
+/* page faults and involuntary context switches per second, every 10s */
+static void report_stats(void)
+{
+	static struct rusage last;
+	static struct timespec last_ts;
+	struct rusage ru;
+	struct timespec ts;
+	double dt;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	dt = (ts.tv_sec - last_ts.tv_sec) +
+	    (ts.tv_nsec - last_ts.tv_nsec) / 1e9;
+	if (last_ts.tv_sec && dt < 10.0)
+		return;
+
+	getrusage(RUSAGE_SELF, &ru);
+	if (last_ts.tv_sec)
+		fprintf(stderr,
+			"faults: %.1f/s (major %.1f/s), involuntary switches: %.1f/s\n",
+			(ru.ru_minflt + ru.ru_majflt - last.ru_minflt -
+			 last.ru_majflt) / dt,
+			(ru.ru_majflt - last.ru_majflt) / dt,
+			(ru.ru_nivcsw - last.ru_nivcsw) / dt);
+	last = ru;
+	last_ts = ts;
+}
+
 int main(int argc, char *argv[])
 {
 	ws2811_return_t ret;
@@ -346,23 +494,47 @@ int main(int argc, char *argv[])
 		return ret;
 	}
 
+	char filename[sizeof(GBD_STREAM_PREFIX) + GBD_STREAM_NAME_MAX];
 	int *beat_cnt_map;
-	beat_cnt_map = (int *)shm_init(GBD_BEAT_COUNT_FILE);
+
+	if (stream)
+		snprintf(filename, sizeof(filename), GBD_STREAM_PREFIX "%s",
+			 stream);
+	else
+		snprintf(filename, sizeof(filename), GBD_BEAT_COUNT_FILE);
+	beat_cnt_map = (int *)shm_init(filename);
 	if (!beat_cnt_map) {
 		fprintf(stderr, "Could not open GBD IPC file!\n");
 		return -1;
 	}
 
+	setup_realtime();
+
+	gbd_trace_t *trace = NULL;
+
+	if (tracing) {
+		trace = gbd_trace_open("segments", stream);
+		if (!trace)
+			fprintf(stderr, "Could not create trace buffer: %s\n",
+				strerror(errno));
+	}
+
 	while (running) {
 		static int bcnt, tmp_cnt;
 		static uint32_t color = 0x00202000;
 		static int prevcnt[GBD_BEAT_COUNT_BUF_SIZE];
+		uint32_t seq = 0;
+		int observed = 0;
 
 		usleep(1000000 / 30);	/* 30 FPS */
 
+		if (show_stats)
+			report_stats();
+
 		if (beat_cnt_map[KICKDRUM] != prevcnt[KICKDRUM]) {
 			prevcnt[KICKDRUM] = beat_cnt_map[KICKDRUM];
 			printf("BassBeat (%i)\n", bcnt++);
+			observed = 1;
 		}
 
 		if (beat_cnt_map[BASSLINE] != prevcnt[BASSLINE]) {
@@ -374,6 +546,12 @@ int main(int argc, char *argv[])
 			else
 				color = 0x00200020;
 			tmp_cnt = ++tmp_cnt > 2 ? 0 : tmp_cnt;
+			observed = 1;
+		}
+
+		if (observed && trace) {
+			seq = beat_cnt_map[TRACE_SEQ];
+			gbd_trace(trace, GBD_TRACE_OBSERVE, seq, gbd_trace_now());
 		}
 
 		{
@@ -406,6 +584,9 @@ int main(int argc, char *argv[])
 					ws2811_get_return_t_str(ret));
 				break;
 			}
+			if (observed && trace)
+				gbd_trace(trace, GBD_TRACE_OUTPUT, seq,
+					  gbd_trace_now());
 		}
 	}
 
@@ -416,6 +597,7 @@ int main(int argc, char *argv[])
 	}
 
 	ws2811_fini(&ledstring);
+	gbd_trace_close(trace);
 
 	printf("\n");
 	return ret;